@@ -0,0 +1,257 @@
+#include "BodyEncoders.h"
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "Request.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** Appends the string to aDest, percent-encoded for application/x-www-form-urlencoded. */
+static void appendFormEncoded(std::string & aDest, const std::string & aValue)
+{
+	static const char HEX[] = "0123456789ABCDEF";
+	for (auto ch: aValue)
+	{
+		auto c = static_cast<unsigned char>(ch);
+		if (
+			((c >= 'a') && (c <= 'z')) ||
+			((c >= 'A') && (c <= 'Z')) ||
+			((c >= '0') && (c <= '9')) ||
+			(c == '*') || (c == '-') || (c == '.') || (c == '_')
+		)
+		{
+			aDest.push_back(ch);
+		}
+		else if (c == ' ')
+		{
+			aDest.push_back('+');
+		}
+		else
+		{
+			aDest.push_back('%');
+			aDest.push_back(HEX[c >> 4]);
+			aDest.push_back(HEX[c & 0x0f]);
+		}
+	}
+}
+
+
+
+
+
+/** Returns the value escaped for use in a quoted Content-Disposition parameter (name, filename). */
+static std::string escapeDispositionParam(const std::string & aValue)
+{
+	std::string res;
+	res.reserve(aValue.size());
+	for (auto ch: aValue)
+	{
+		switch (ch)
+		{
+			case '"':  res.append("%22"); break;
+			case '\r': res.append("%0D"); break;
+			case '\n': res.append("%0A"); break;
+			default:   res.push_back(ch); break;
+		}
+	}
+	return res;
+}
+
+
+
+
+
+std::string encodeForm(const std::vector<std::pair<std::string, std::string>> & aFields)
+{
+	std::string res;
+	for (const auto & field: aFields)
+	{
+		if (!res.empty())
+		{
+			res.push_back('&');
+		}
+		appendFormEncoded(res, field.first);
+		res.push_back('=');
+		appendFormEncoded(res, field.second);
+	}
+	return res;
+}
+
+
+
+
+
+#ifdef _DEBUG
+struct TestEncodeForm
+{
+	TestEncodeForm()
+	{
+		testEncode({},                                          "");
+		testEncode({{"a", "1"}},                                "a=1");
+		testEncode({{"a", "1"}, {"a", "2"}, {"b", ""}},         "a=1&a=2&b=");
+		testEncode({{"q", "hello world"}},                      "q=hello+world");
+		testEncode({{"k&=", "v+%/?"}},                          "k%26%3D=v%2B%25%2F%3F");
+		testEncode({{"safe", "AZaz09*-._"}},                    "safe=AZaz09*-._");
+		testEncode({{"utf8", "\xc3\xa9"}},                      "utf8=%C3%A9");
+	}
+
+	/** Asserts that encoding the fields results in the expected body. */
+	void testEncode(const std::vector<std::pair<std::string, std::string>> & aFields, const std::string & aExpected)
+	{
+		assert(encodeForm(aFields) == aExpected);
+	}
+} gTestEncodeForm;
+#endif  // _DEBUG
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MultipartBody:
+
+MultipartBody::MultipartBody(std::vector<Part> && aParts):
+	mContentLength(0)
+{
+	// Generate a random boundary:
+	std::random_device rd;
+	std::mt19937_64 rng(rd());
+	mBoundary = fmt::format("----LuaSimpleWinHttp{:016x}{:016x}", rng(), rng());
+
+	// Precompute the part headers and sizes:
+	mParts.reserve(aParts.size());
+	for (auto & part: aParts)
+	{
+		EncodedPart encoded;
+		encoded.mHeader = fmt::format("--{}\r\nContent-Disposition: form-data; name=\"{}\"", mBoundary, escapeDispositionParam(part.mName));
+		if (part.mFilePath.empty())
+		{
+			encoded.mDataSize = part.mValue.size();
+			if (!part.mContentType.empty())
+			{
+				encoded.mHeader.append(fmt::format("\r\nContent-Type: {}", part.mContentType));
+			}
+		}
+		else
+		{
+			auto path = std::filesystem::u8path(part.mFilePath);
+			std::error_code ec;
+			encoded.mDataSize = std::filesystem::file_size(path, ec);
+			if (ec)
+			{
+				throw Exception(fmt::format("Cannot send file \"{}\" as a multipart body part: {}", part.mFilePath, ec.message()));
+			}
+			if (part.mFileName.empty())
+			{
+				part.mFileName = path.filename().u8string();
+			}
+			encoded.mHeader.append(fmt::format("; filename=\"{}\"\r\nContent-Type: {}",
+				escapeDispositionParam(part.mFileName),
+				part.mContentType.empty() ? "application/octet-stream" : part.mContentType
+			));
+		}
+		encoded.mHeader.append("\r\n\r\n");
+		mContentLength += encoded.mHeader.size() + encoded.mDataSize + 2;  // The data is followed by a CRLF
+		encoded.mPart = std::move(part);
+		mParts.push_back(std::move(encoded));
+	}
+	mContentLength += mBoundary.size() + 6;  // The closing "--<boundary>--\r\n"
+}
+
+
+
+
+
+std::string MultipartBody::contentType() const
+{
+	return fmt::format("multipart/form-data; boundary={}", mBoundary);
+}
+
+
+
+
+
+void MultipartBody::write(const Writer & aWriter) const
+{
+	for (const auto & part: mParts)
+	{
+		aWriter(part.mHeader.data(), part.mHeader.size());
+		if (part.mPart.mFilePath.empty())
+		{
+			aWriter(part.mPart.mValue.data(), part.mPart.mValue.size());
+		}
+		else
+		{
+			std::ifstream f(std::filesystem::u8path(part.mPart.mFilePath), std::ios::binary);
+			if (!f.is_open())
+			{
+				throw Exception(fmt::format("Cannot open file \"{}\" for sending as a multipart body part.", part.mPart.mFilePath));
+			}
+			std::uint64_t remaining = part.mDataSize;
+			char buf[64 * 1024];
+			while (remaining > 0)
+			{
+				auto toRead = static_cast<std::streamsize>(std::min<std::uint64_t>(remaining, sizeof(buf)));
+				f.read(buf, toRead);
+				if (f.gcount() != toRead)
+				{
+					throw Exception(fmt::format("Failed to read file \"{}\" for sending as a multipart body part, the file has been truncated.", part.mPart.mFilePath));
+				}
+				aWriter(buf, static_cast<size_t>(toRead));
+				remaining -= static_cast<std::uint64_t>(toRead);
+			}
+		}
+		aWriter("\r\n", 2);
+	}
+	auto closing = fmt::format("--{}--\r\n", mBoundary);
+	aWriter(closing.data(), closing.size());
+}
+
+
+
+
+
+#ifdef _DEBUG
+struct TestMultipartBody
+{
+	TestMultipartBody()
+	{
+		MultipartBody::Part plain{"field", "value", "", "", ""};
+		MultipartBody::Part typed{"json\"name", "{}", "", "", "application/json"};
+		MultipartBody body({plain, typed});
+		std::string written;
+		body.write([&written](const char * aData, size_t aSize)
+			{
+				written.append(aData, aSize);
+			}
+		);
+		auto boundary = body.contentType().substr(body.contentType().find("boundary=") + 9);
+		assert(written.size() == body.contentLength());
+		assert(written.compare(0, boundary.size() + 2, "--" + boundary) == 0);
+		assert(written.find("name=\"field\"\r\n\r\nvalue\r\n") != std::string::npos);
+		assert(written.find("name=\"json%22name\"\r\nContent-Type: application/json\r\n\r\n{}\r\n") != std::string::npos);
+		assert(written.compare(written.size() - boundary.size() - 6, std::string::npos, "--" + boundary + "--\r\n") == 0);
+	}
+} gTestMultipartBody;
+#endif  // _DEBUG
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
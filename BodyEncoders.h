@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** Encodes the fields as an application/x-www-form-urlencoded request body.
+The fields are encoded in the order given; the same name may appear multiple times. */
+std::string encodeForm(const std::vector<std::pair<std::string, std::string>> & aFields);
+
+
+
+
+
+/** A multipart/form-data request body that is streamed to the server rather than built in memory.
+The file parts are read from the disk only while sending; their sizes are queried upfront so that the
+total Content-Length is known before the request is sent. */
+class MultipartBody
+{
+public:
+
+	/** A single part of the body, either a plain value or a file. */
+	struct Part
+	{
+		/** The form field name. */
+		std::string mName;
+
+		/** The value to send, for plain value parts. */
+		std::string mValue;
+
+		/** The path (UTF-8) of the file to send, for file parts. Empty for plain value parts. */
+		std::string mFilePath;
+
+		/** The file name reported to the server. If empty for a file part, the file's own name is used. */
+		std::string mFileName;
+
+		/** The content type of the part. If empty, no Content-Type is sent for value parts and
+		"application/octet-stream" is sent for file parts. */
+		std::string mContentType;
+	};
+
+	/** Function that receives the consecutive chunks of the encoded body. */
+	using Writer = std::function<void(const char * aData, size_t aSize)>;
+
+
+	/** Creates a new body from the specified parts, generating a random boundary.
+	Queries the sizes of all the file parts; throws an Exception if any of them cannot be accessed. */
+	MultipartBody(std::vector<Part> && aParts);
+
+	/** Returns the Content-Type header value, including the boundary. */
+	std::string contentType() const;
+
+	/** Returns the total size of the encoded body, in bytes. */
+	std::uint64_t contentLength() const { return mContentLength; }
+
+	/** Streams the entire encoded body, in chunks, to the specified writer.
+	Throws an Exception if a file cannot be read or has changed its size since the body was created. */
+	void write(const Writer & aWriter) const;
+
+
+private:
+
+	/** A part along with its precomputed encoding details. */
+	struct EncodedPart
+	{
+		Part mPart;
+
+		/** The boundary line and the part headers, including the empty line that separates them from the data. */
+		std::string mHeader;
+
+		/** The size of the part's data. */
+		std::uint64_t mDataSize;
+	};
+
+
+	/** The boundary separating the individual parts. */
+	std::string mBoundary;
+
+	/** The parts to send. */
+	std::vector<EncodedPart> mParts;
+
+	/** The total size of the encoded body. */
+	std::uint64_t mContentLength;
+};
+
+}
@@ -0,0 +1,135 @@
+#include "ByteBuffer.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <fmt/format.h>
+
+#include "Request.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+ByteBuffer::ByteBuffer(std::uint64_t aSpillThreshold):
+	mFile(INVALID_HANDLE_VALUE),
+	mMapping(nullptr),
+	mMapped(nullptr),
+	mSpillThreshold(aSpillThreshold),
+	mSize(0),
+	mIsFinished(false)
+{
+}
+
+
+
+
+
+ByteBuffer::~ByteBuffer()
+{
+	if (mMapped != nullptr)
+	{
+		UnmapViewOfFile(mMapped);
+	}
+	if (mMapping != nullptr)
+	{
+		CloseHandle(mMapping);
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);  // The file is deleted on close
+	}
+}
+
+
+
+
+
+void ByteBuffer::spill()
+{
+	wchar_t tempPath[MAX_PATH + 1];
+	wchar_t tempFileName[MAX_PATH + 1];
+	if ((GetTempPathW(MAX_PATH + 1, tempPath) == 0) || (GetTempFileNameW(tempPath, L"lsw", 0, tempFileName) == 0))
+	{
+		throw Exception(fmt::format("Failed to create a temporary file for the response body, error code 0x{:x}.", GetLastError()));
+	}
+	mFile = CreateFileW(
+		tempFileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr
+	);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		throw Exception(fmt::format("Failed to open a temporary file for the response body, CreateFileW() failed with error code 0x{:x}.", GetLastError()));
+	}
+	std::string memory;
+	std::swap(memory, mMemory);  // Release the memory once written
+	mSize = 0;
+	append(memory.data(), memory.size());
+}
+
+
+
+
+
+void ByteBuffer::append(const char * aData, size_t aSize)
+{
+	assert(!mIsFinished);
+	if ((mFile == INVALID_HANDLE_VALUE) && (mSize + aSize > mSpillThreshold))
+	{
+		spill();
+	}
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		mMemory.append(aData, aSize);
+		mSize += aSize;
+		return;
+	}
+	while (aSize > 0)
+	{
+		DWORD written = 0;
+		if (!WriteFile(mFile, aData, static_cast<DWORD>(std::min<size_t>(aSize, 0x40000000)), &written, nullptr) || (written == 0))
+		{
+			throw Exception(fmt::format("Failed to write the response body into a temporary file, WriteFile() failed with error code 0x{:x}.", GetLastError()));
+		}
+		aData += written;
+		aSize -= written;
+		mSize += written;
+	}
+}
+
+
+
+
+
+void ByteBuffer::finish()
+{
+	assert(!mIsFinished);
+	mIsFinished = true;
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping == nullptr)
+	{
+		throw Exception(fmt::format("Failed to map the response body temporary file, CreateFileMappingW() failed with error code 0x{:x}.", GetLastError()));
+	}
+	mMapped = static_cast<const char *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (mMapped == nullptr)
+	{
+		throw Exception(fmt::format("Failed to map the response body temporary file, MapViewOfFile() failed with error code 0x{:x}.", GetLastError()));
+	}
+}
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
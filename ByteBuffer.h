@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#define NOMINMAX
+#include <Windows.h>
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** A growable, read-only-once-finished buffer for large response bodies.
+The data is kept in memory until it exceeds a threshold; after that it is spilled into a temporary file, which is
+memory-mapped once the buffer is finished, so that even huge bodies don't need to fit into the process heap.
+The temporary file is deleted automatically when the buffer is destroyed.
+Usage: append() all the data, call finish(), then use data() and size(). */
+class ByteBuffer
+{
+	/** The data, while it is small enough to be kept in memory. */
+	std::string mMemory;
+
+	/** The temporary file holding the data after it has been spilled, or INVALID_HANDLE_VALUE. */
+	HANDLE mFile;
+
+	/** The mapping of mFile, created by finish(). */
+	HANDLE mMapping;
+
+	/** The mapped view of mFile, created by finish(). */
+	const char * mMapped;
+
+	/** The size of the data above which it is spilled into a temporary file. */
+	std::uint64_t mSpillThreshold;
+
+	/** The total size of the data. */
+	std::uint64_t mSize;
+
+	/** Set by finish(), no more data can be appended afterwards. */
+	bool mIsFinished;
+
+
+	/** Moves the data from mMemory into a newly created temporary file.
+	Throws an Exception on error. */
+	void spill();
+
+
+public:
+
+	/** The default size of the data above which it is spilled into a temporary file. */
+	static const std::uint64_t SPILL_THRESHOLD = 64 * 1024 * 1024;
+
+
+	/** Creates an empty buffer that spills its data into a temporary file once it exceeds aSpillThreshold bytes. */
+	ByteBuffer(std::uint64_t aSpillThreshold = SPILL_THRESHOLD);
+
+	~ByteBuffer();
+
+	ByteBuffer(const ByteBuffer &) = delete;
+	ByteBuffer & operator = (const ByteBuffer &) = delete;
+
+	/** Appends the data to the end of the buffer.
+	Throws an Exception on error. */
+	void append(const char * aData, size_t aSize);
+
+	/** Finishes the buffer, mapping the temporary file if the data was spilled.
+	Throws an Exception on error. */
+	void finish();
+
+	/** Returns the pointer to the data. Only valid after finish(). */
+	const char * data() const { return (mMapped != nullptr) ? mMapped : mMemory.data(); }
+
+	/** Returns the size of the data. */
+	size_t size() const { return static_cast<size_t>(mSize); }
+};
+
+}
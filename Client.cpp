@@ -0,0 +1,396 @@
+#include "Client.h"
+
+#include <condition_variable>
+#include <exception>
+#include <system_error>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include "Request.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+struct Client::Flight
+{
+	/** Protects the rest of the members. */
+	std::mutex mMtx;
+
+	/** Notified when the request is done. */
+	std::condition_variable mCV;
+
+	/** Set when the request has finished, either with mResponse or with mError. */
+	bool mIsDone = false;
+
+	/** The response received, shared by all the waiters. */
+	Response mResponse;
+
+	/** The exception thrown by the request, rethrown to all the waiters. */
+	std::exception_ptr mError;
+};
+
+
+
+
+
+/** Returns true if the system has a proxy configured that a WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY session may use:
+a static proxy in the WinHttp or the user's settings, an auto-config script, or the proxy auto-detection. */
+static bool detectProxyConfiguration()
+{
+	bool res = false;
+	WINHTTP_PROXY_INFO proxyInfo = {};
+	if (WinHttpGetDefaultProxyConfiguration(&proxyInfo))
+	{
+		res = (proxyInfo.dwAccessType == WINHTTP_ACCESS_TYPE_NAMED_PROXY);
+		GlobalFree(proxyInfo.lpszProxy);
+		GlobalFree(proxyInfo.lpszProxyBypass);
+	}
+	WINHTTP_CURRENT_USER_IE_PROXY_CONFIG userConfig = {};
+	if (WinHttpGetIEProxyConfigForCurrentUser(&userConfig))
+	{
+		res = res || userConfig.fAutoDetect || (userConfig.lpszAutoConfigUrl != nullptr) || (userConfig.lpszProxy != nullptr);
+		GlobalFree(userConfig.lpszAutoConfigUrl);
+		GlobalFree(userConfig.lpszProxy);
+		GlobalFree(userConfig.lpszProxyBypass);
+	}
+	return res;
+}
+
+
+
+
+
+/** A single background warm-up started by preconnect(). */
+struct Client::WarmUp
+{
+	/** The thread running the warm-up. */
+	std::thread mThread;
+
+	/** The request handle while the request is being sent, so that the destructor can close it, which aborts
+	the request. Set to nullptr by whoever closes it. Protected by Client::mMtxWarmUps. */
+	HINTERNET mRequest = nullptr;
+
+	/** Set when the warm-up has finished, so that mThread can be joined without waiting.
+	Protected by Client::mMtxWarmUps. */
+	bool mIsDone = false;
+};
+
+
+
+
+
+Client::Client(const std::wstring & aUserAgent):
+	mSession(WinHttpOpen(aUserAgent.c_str(), WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY, nullptr, nullptr, 0)),
+	mIsProxyConfigured(detectProxyConfiguration()),
+	mNumFullHandshakes(0),
+	mNumResumedHandshakes(0),
+	mNumReusedConnections(0),
+	mIsCoalescingEnabled(false),
+	mNumCoalescingLeaders(0),
+	mNumCoalesced(0),
+	mIsClosing(false)
+{
+}
+
+
+
+
+
+Client::~Client()
+{
+	// Abort the warm-ups still sending (closing the session alone doesn't abort a synchronous request, only
+	// closing its request handle does), then wait for all of them, before the session goes away:
+	{
+		std::lock_guard<std::mutex> lock(mMtxWarmUps);
+		mIsClosing = true;
+		for (auto & warmUp: mWarmUps)
+		{
+			if (warmUp.mRequest != nullptr)
+			{
+				WinHttpCloseHandle(warmUp.mRequest);
+				warmUp.mRequest = nullptr;
+			}
+		}
+	}
+	for (auto & warmUp: mWarmUps)
+	{
+		warmUp.mThread.join();
+	}
+
+	if (mSession != nullptr)
+	{
+		WinHttpCloseHandle(mSession);
+	}
+}
+
+
+
+
+
+Client & Client::defaultClient()
+{
+	static Client inst;
+	return inst;
+}
+
+
+
+
+
+void Client::updateTlsStats(HINTERNET aRequest)
+{
+#ifdef WINHTTP_OPTION_REQUEST_STATS
+	WINHTTP_REQUEST_STATS stats = {};
+	DWORD size = sizeof(stats);
+	if (!WinHttpQueryOption(aRequest, WINHTTP_OPTION_REQUEST_STATS, &stats, &size))
+	{
+		return;
+	}
+	if ((stats.ullFlags & WINHTTP_REQUEST_STAT_FLAG_FIRST_REQUEST) == 0)
+	{
+		++mNumReusedConnections;
+	}
+	else if ((stats.ullFlags & WINHTTP_REQUEST_STAT_FLAG_TLS_SESSION_RESUMPTION) != 0)
+	{
+		++mNumResumedHandshakes;
+	}
+	else
+	{
+		++mNumFullHandshakes;
+	}
+#else
+	(void)aRequest;
+#endif
+}
+
+
+
+
+
+Client::TlsStats Client::tlsStats() const
+{
+	return {mNumFullHandshakes.load(), mNumResumedHandshakes.load(), mNumReusedConnections.load()};
+}
+
+
+
+
+
+Response Client::coalesce(const std::string & aKey, const std::function<Response()> & aMake)
+{
+	// Join an in-flight request, or become the leader of a new one:
+	std::shared_ptr<Flight> flight;
+	bool isLeader = false;
+	{
+		std::lock_guard<std::mutex> lock(mMtxFlights);
+		auto & slot = mFlights[aKey];
+		if (slot == nullptr)
+		{
+			slot = std::make_shared<Flight>();
+			isLeader = true;
+		}
+		flight = slot;
+	}
+
+	if (!isLeader)
+	{
+		++mNumCoalesced;
+		std::unique_lock<std::mutex> lock(flight->mMtx);
+		flight->mCV.wait(lock, [&flight]() { return flight->mIsDone; });
+		if (flight->mError != nullptr)
+		{
+			std::rethrow_exception(flight->mError);
+		}
+		return flight->mResponse;
+	}
+
+	// Make the request, then publish the result to the waiters:
+	++mNumCoalescingLeaders;
+	Response res;
+	std::exception_ptr error;
+	try
+	{
+		res = aMake();
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+	{
+		// Requests arriving from now on will start a new flight:
+		std::lock_guard<std::mutex> lock(mMtxFlights);
+		mFlights.erase(aKey);
+	}
+	{
+		std::lock_guard<std::mutex> lock(flight->mMtx);
+		flight->mIsDone = true;
+		flight->mError = error;
+		if (error == nullptr)
+		{
+			flight->mResponse = res;
+		}
+	}
+	flight->mCV.notify_all();
+	if (error != nullptr)
+	{
+		std::rethrow_exception(error);
+	}
+	return res;
+}
+
+
+
+
+
+Client::CoalescingStats Client::coalescingStats() const
+{
+	return {mNumCoalescingLeaders.load(), mNumCoalesced.load()};
+}
+
+
+
+
+
+void Client::preconnect(const std::string & aUrl, unsigned aCount)
+{
+	// While replaying, nothing may go to the network:
+	if (replayer() != nullptr)
+	{
+		return;
+	}
+	auto url = Request::parseUrl(aUrl, std::pmr::get_default_resource());
+
+	std::lock_guard<std::mutex> lock(mMtxWarmUps);
+
+	// Join the finished warm-ups, so that only the running ones count towards the limit:
+	for (auto itr = mWarmUps.begin(); itr != mWarmUps.end();)
+	{
+		if (itr->mIsDone)
+		{
+			itr->mThread.join();
+			itr = mWarmUps.erase(itr);
+		}
+		else
+		{
+			++itr;
+		}
+	}
+
+	// Concurrent requests, so that each needs its own connection:
+	for (; (aCount > 0) && (mWarmUps.size() < MAX_WARM_UPS); --aCount)
+	{
+		auto & warmUp = mWarmUps.emplace_back();
+		try
+		{
+			warmUp.mThread = std::thread([this, &warmUp, url]()
+				{
+					const auto & [isSecure, serverName, port, path] = url;
+					runWarmUp(warmUp, isSecure, serverName, port, path);
+				}
+			);
+		}
+		catch (const std::system_error & exc)
+		{
+			mWarmUps.pop_back();
+			throw Exception(fmt::format("Failed to start a preconnect thread: {}", exc.what()));
+		}
+		catch (...)
+		{
+			mWarmUps.pop_back();
+			throw;
+		}
+	}
+}
+
+
+
+
+
+void Client::runWarmUp(WarmUp & aWarmUp, bool aIsSecure, const std::pmr::wstring & aServerName, std::uint16_t aPort, const std::pmr::wstring & aPath)
+{
+	auto connection = WinHttpConnect(mSession, aServerName.c_str(), aPort, 0);
+	auto request = (connection == nullptr) ? nullptr :
+		WinHttpOpenRequest(connection, L"HEAD", aPath.c_str(), nullptr, WINHTTP_NO_REFERER, nullptr, WINHTTP_FLAG_ESCAPE_PERCENT | (aIsSecure ? WINHTTP_FLAG_SECURE : 0));
+	bool shouldSend;
+	{
+		std::lock_guard<std::mutex> lock(mMtxWarmUps);
+		aWarmUp.mRequest = request;
+		shouldSend = (request != nullptr) && !mIsClosing;
+	}
+
+	// From now on the destructor may close the request at any time, the calls then fail.
+	// The response has no body, closing the request returns the connection into the session's pool:
+	if (shouldSend && WinHttpSendRequest(request, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0))
+	{
+		WinHttpReceiveResponse(request, nullptr);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMtxWarmUps);
+		if (aWarmUp.mRequest != nullptr)
+		{
+			WinHttpCloseHandle(aWarmUp.mRequest);
+			aWarmUp.mRequest = nullptr;
+		}
+		aWarmUp.mIsDone = true;
+	}
+	if (connection != nullptr)
+	{
+		WinHttpCloseHandle(connection);
+	}
+}
+
+
+
+
+
+void Client::setRecorder(std::shared_ptr<TrafficRecorder> aRecorder)
+{
+	std::lock_guard<std::mutex> lock(mMtxTraffic);
+	mRecorder = std::move(aRecorder);
+}
+
+
+
+
+
+void Client::setReplayer(std::shared_ptr<TrafficReplayer> aReplayer)
+{
+	std::lock_guard<std::mutex> lock(mMtxTraffic);
+	mReplayer = std::move(aReplayer);
+}
+
+
+
+
+
+std::shared_ptr<TrafficRecorder> Client::recorder() const
+{
+	std::lock_guard<std::mutex> lock(mMtxTraffic);
+	return mRecorder;
+}
+
+
+
+
+
+std::shared_ptr<TrafficReplayer> Client::replayer() const
+{
+	std::lock_guard<std::mutex> lock(mMtxTraffic);
+	return mReplayer;
+}
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <winhttp.h>
+
+#include "DnsCache.h"
+#include "TrafficLog.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+// fwd: Request.h
+struct Response;
+
+
+
+
+
+/** Represents a WinHttp session that can be used for making Requests.
+All the requests made through a single Client share its settings, cookies and the underlying connection pool.
+The Lua bindings all use the defaultClient(); C++ code can use the same one in order to share the connections
+with the Lua scripts, or create its own instances. */
+class Client
+{
+	/** The WinHttp session handle, as returned by WinHttpOpen(). */
+	HINTERNET mSession;
+
+	/** True if the system has a proxy configured that the session may use; the DNS cache is skipped then. */
+	bool mIsProxyConfigured;
+
+	/** The number of HTTPS requests that needed a new connection with a full TLS handshake. */
+	std::atomic<std::uint64_t> mNumFullHandshakes;
+
+	/** The number of HTTPS requests that needed a new connection, but resumed a cached TLS session. */
+	std::atomic<std::uint64_t> mNumResumedHandshakes;
+
+	/** The number of HTTPS requests sent over an already established connection, with no handshake. */
+	std::atomic<std::uint64_t> mNumReusedConnections;
+
+	/** Protects mRecorder and mReplayer against concurrent access. */
+	mutable std::mutex mMtxTraffic;
+
+	/** If set, all the exchanges made through this client are recorded into it. */
+	std::shared_ptr<TrafficRecorder> mRecorder;
+
+	/** If set, all the requests made through this client are served from it instead of the network. */
+	std::shared_ptr<TrafficReplayer> mReplayer;
+
+	/** A single in-flight request that identical concurrent requests wait for. Defined in Client.cpp. */
+	struct Flight;
+
+	/** Protects mFlights against concurrent access. */
+	std::mutex mMtxFlights;
+
+	/** The coalescable requests currently in flight, by their key. */
+	std::unordered_map<std::string, std::shared_ptr<Flight>> mFlights;
+
+	/** If true, all eligible requests are coalesced, even those that don't ask for it. */
+	std::atomic<bool> mIsCoalescingEnabled;
+
+	/** The number of coalescable requests that were actually sent. */
+	std::atomic<std::uint64_t> mNumCoalescingLeaders;
+
+	/** The number of requests that were not sent, but shared the response of an identical in-flight request. */
+	std::atomic<std::uint64_t> mNumCoalesced;
+
+	/** The DNS cache, used by the requests once enabled. */
+	DnsCache mDnsCache;
+
+	/** A single background warm-up started by preconnect(). Defined in Client.cpp. */
+	struct WarmUp;
+
+	/** Protects mWarmUps and mIsClosing against concurrent access. */
+	std::mutex mMtxWarmUps;
+
+	/** The warm-ups started by preconnect(), both running and finished ones that haven't been joined yet. */
+	std::list<WarmUp> mWarmUps;
+
+	/** Set by the destructor, so that the warm-ups that haven't sent their request yet don't send it. */
+	bool mIsClosing;
+
+
+	/** Sends the HEAD request of a single warm-up and discards the response. Runs on the warm-up's thread. */
+	void runWarmUp(WarmUp & aWarmUp, bool aIsSecure, const std::pmr::wstring & aServerName, std::uint16_t aPort, const std::pmr::wstring & aPath);
+
+
+public:
+
+	/** Creates a new session that will identify itself with the specified user agent. */
+	Client(const std::wstring & aUserAgent = L"LuaSimpleWinHttp/0.1");
+
+	~Client();
+
+	Client(const Client &) = delete;
+	Client & operator = (const Client &) = delete;
+
+	/** Returns the process-wide Client instance used by the Lua bindings. */
+	static Client & defaultClient();
+
+	/** Returns the WinHttp session handle. */
+	HINTERNET session() const { return mSession; }
+
+	/** Updates the TLS handshake counters from the statistics of the specified (received) HTTPS request.
+	Does nothing if the OS doesn't provide the request statistics (before Windows 10 1709). */
+	void updateTlsStats(HINTERNET aRequest);
+
+	/** The TLS handshake counters, see tlsStats(). */
+	struct TlsStats
+	{
+		std::uint64_t mNumFullHandshakes;
+		std::uint64_t mNumResumedHandshakes;
+		std::uint64_t mNumReusedConnections;
+	};
+
+	/** Returns the TLS handshake counters for all the HTTPS requests made through this client. */
+	TlsStats tlsStats() const;
+
+	/** Sets whether all the eligible requests should be coalesced, not only those that ask for it. */
+	void setCoalescingEnabled(bool aIsEnabled) { mIsCoalescingEnabled = aIsEnabled; }
+
+	/** Returns true if all the eligible requests should be coalesced. */
+	bool isCoalescingEnabled() const { return mIsCoalescingEnabled; }
+
+	/** Makes a coalescable request: if there's no request with the same key in flight, calls aMake and shares its
+	result with all the requests of the same key that arrive meanwhile; otherwise waits for the in-flight request
+	and returns a copy of its response (or rethrows its exception). */
+	Response coalesce(const std::string & aKey, const std::function<Response()> & aMake);
+
+	/** The coalescing counters, see coalescingStats(). */
+	struct CoalescingStats
+	{
+		std::uint64_t mNumLeaders;
+		std::uint64_t mNumCoalesced;
+	};
+
+	/** Returns the coalescing counters for this client. */
+	CoalescingStats coalescingStats() const;
+
+	/** The maximum number of warm-ups that may run at the same time, over all the preconnect() calls. */
+	static constexpr size_t MAX_WARM_UPS = 16;
+
+	/** Starts establishing aCount connections to the server of the specified URL in the background, by sending
+	concurrent HEAD requests to the URL, each on its own thread, so that the name resolution, connecting and TLS
+	handshake are done before the first real request to the server needs them.
+	Returns immediately; the established connections are kept alive by WinHttp for the following requests.
+	Starts only as many warm-ups as fit into MAX_WARM_UPS with those still running, and none while replaying.
+	The destructor cancels the warm-ups still running and waits for them.
+	Throws an Exception if the URL is malformed or a thread cannot be started; warm-up failures are ignored,
+	the real requests report them. */
+	void preconnect(const std::string & aUrl, unsigned aCount = 1);
+
+	/** Returns the refresh-ahead DNS prefetcher for the names of the used servers. */
+	DnsCache & dnsCache() { return mDnsCache; }
+
+	/** Returns true if the system had a proxy configured when the client was created (a static proxy, an auto-config
+	script, or the proxy auto-detection), so the requests may go through a proxy, which resolves the names itself. */
+	bool isProxyConfigured() const { return mIsProxyConfigured; }
+
+	/** Starts recording all the exchanges into the specified recorder; nullptr stops recording. */
+	void setRecorder(std::shared_ptr<TrafficRecorder> aRecorder);
+
+	/** Starts serving all the requests from the specified replayer; nullptr goes back to the network. */
+	void setReplayer(std::shared_ptr<TrafficReplayer> aReplayer);
+
+	/** Returns the current recorder, or nullptr if not recording. */
+	std::shared_ptr<TrafficRecorder> recorder() const;
+
+	/** Returns the current replayer, or nullptr if not replaying. */
+	std::shared_ptr<TrafficReplayer> replayer() const;
+};
+
+}
@@ -0,0 +1,323 @@
+#include "DnsCache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cwctype>
+#include <thread>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <windns.h>
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** Returns the server name in lowercase, so that the differently-cased names share the entry. */
+static std::wstring lowercase(std::wstring_view aServerName)
+{
+	std::wstring res(aServerName);
+	for (auto & ch: res)
+	{
+		ch = static_cast<wchar_t>(std::towlower(ch));
+	}
+	return res;
+}
+
+
+
+
+
+#ifdef _DEBUG
+/** Checks the prefetching and the refresh-ahead with a stub resolver, launcher and clock, without any DNS queries
+or threads (the self-tests run while the DLL is being loaded, waiting for a new thread then would deadlock). */
+struct TestDnsCache
+{
+	TestDnsCache()
+	{
+		// The stub resolver fails "bad.example" and resolves everything else with a 100-second TTL:
+		auto numLookups = std::make_shared<int>(0);
+		auto numRefreshes = std::make_shared<int>(0);
+		auto resolver = [numLookups, numRefreshes](const std::wstring & aServerName, bool aIsRefresh)
+		{
+			++*(aIsRefresh ? numRefreshes : numLookups);
+			return (aServerName == L"bad.example") ? DnsCache::Resolution{9003, std::chrono::seconds(0)} : DnsCache::Resolution{0, std::chrono::seconds(100)};
+		};
+
+		// The stub launcher only queues the tasks, the test runs them when it needs to:
+		auto tasks = std::make_shared<std::vector<std::function<void()>>>();
+		auto launcher = [tasks](std::function<void()> && aTask)
+		{
+			tasks->push_back(std::move(aTask));
+		};
+		auto runTasks = [tasks]()
+		{
+			auto queued = std::move(*tasks);
+			tasks->clear();
+			for (auto & task: queued)
+			{
+				task();
+			}
+		};
+
+		// The stub clock only moves when the test says so:
+		auto now = std::make_shared<std::chrono::steady_clock::time_point>();
+		auto clock = [now]()
+		{
+			return *now;
+		};
+
+		DnsCache cache(resolver, launcher, clock);
+
+		// A miss starts a cache-only lookup, another miss of the same name (in any case) meanwhile doesn't:
+		cache.prefetch(L"Host.example");
+		cache.prefetch(L"host.example");
+		assert(tasks->size() == 1);
+		runTasks();
+		assert(*numLookups == 1);
+
+		// A valid entry far from its expiry is a hit and isn't refreshed:
+		*now += std::chrono::seconds(50);
+		cache.prefetch(L"HOST.EXAMPLE");
+		assert(tasks->empty());
+
+		// In the last tenth of the TTL, a hit starts a single refresh, which extends the entry past its original expiry:
+		*now += std::chrono::seconds(41);
+		cache.prefetch(L"host.example");
+		cache.prefetch(L"host.example");
+		assert(tasks->size() == 1);
+		runTasks();
+		assert(*numRefreshes == 1);
+		*now += std::chrono::seconds(20);  // 111 s after the lookup, 20 s after the refresh
+		cache.prefetch(L"host.example");
+		assert(tasks->empty());
+
+		// A failure removes the entry, the next prefetch is a miss again:
+		cache.prefetch(L"bad.example");
+		runTasks();
+		cache.prefetch(L"bad.example");
+		assert(tasks->size() == 1);
+		runTasks();
+
+		auto stats = cache.stats();
+		assert(stats.mNumMisses == 4);
+		assert(stats.mNumHits == 4);
+		assert(stats.mNumRefreshes == 1);
+		assert(stats.mNumQueries == 4);
+		assert(stats.mNumFailures == 2);
+		assert(stats.mNumEntries == 1);
+
+		// Flushing drops the entries, and the results of the queries started before it:
+		cache.prefetch(L"other.example");
+		cache.flush();
+		runTasks();
+		assert(cache.stats().mNumEntries == 0);
+
+		assert(DnsCache::isAddressLiteral(L"10.0.0.1"));
+		assert(DnsCache::isAddressLiteral(L"::1"));
+		assert(!DnsCache::isAddressLiteral(L"a1.example"));
+	}
+} gTestDnsCache;
+#endif  // _DEBUG
+
+
+
+
+
+DnsCache::DnsCache(Resolver aResolver, Launcher aLauncher, Clock aClock):
+	mState(std::make_shared<State>()),
+	mLauncher(std::move(aLauncher)),
+	mIsEnabled(false),
+	mNumHits(0),
+	mNumMisses(0),
+	mNumRefreshes(0)
+{
+	mState->mResolver = std::move(aResolver);
+	mState->mClock = std::move(aClock);
+}
+
+
+
+
+
+void DnsCache::query(State & aState, const std::wstring & aServerName, bool aIsRefresh, std::uint64_t aGeneration)
+{
+	auto resolution = aState.mResolver(aServerName, aIsRefresh);
+	++aState.mNumQueries;
+	if (resolution.mError != 0)
+	{
+		++aState.mNumFailures;
+	}
+
+	auto now = aState.mClock();
+	std::lock_guard<std::mutex> lock(aState.mMtx);
+	auto itr = aState.mEntries.find(aServerName);
+	if ((aGeneration != aState.mGeneration) || (itr == aState.mEntries.end()))
+	{
+		return;  // Flushed meanwhile
+	}
+	if (resolution.mError != 0)
+	{
+		aState.mEntries.erase(itr);
+		return;
+	}
+	auto & entry = itr->second;
+	entry.mIsQuerying = false;
+	entry.mTtl = std::clamp(resolution.mTtl, MIN_TTL, MAX_TTL);
+	entry.mExpiry = now + entry.mTtl;
+}
+
+
+
+
+
+void DnsCache::prefetch(std::wstring_view aServerName)
+{
+	auto serverName = lowercase(aServerName);
+	bool isRefresh;
+	std::uint64_t generation;
+	{
+		std::lock_guard<std::mutex> lock(mState->mMtx);
+		auto now = mState->mClock();
+		auto & entry = mState->mEntries.try_emplace(serverName, Entry{MIN_TTL, now, false}).first->second;
+		isRefresh = (now < entry.mExpiry);
+		if (isRefresh)
+		{
+			++mNumHits;
+			if (entry.mIsQuerying || (now < entry.mExpiry - std::chrono::duration_cast<std::chrono::milliseconds>(entry.mTtl) / REFRESH_AHEAD_DIVISOR))
+			{
+				return;
+			}
+			++mNumRefreshes;
+		}
+		else
+		{
+			++mNumMisses;
+			if (entry.mIsQuerying)
+			{
+				return;
+			}
+		}
+		entry.mIsQuerying = true;
+		generation = mState->mGeneration;
+	}
+
+	// Launch without holding the lock, the launcher may run the task right away:
+	try
+	{
+		mLauncher([state = mState, serverName, isRefresh, generation]()
+			{
+				query(*state, serverName, isRefresh, generation);
+			}
+		);
+	}
+	catch (const std::exception &)
+	{
+		// Failed to start the query, let the next prefetch() try again:
+		std::lock_guard<std::mutex> lock(mState->mMtx);
+		auto itr = mState->mEntries.find(serverName);
+		if (itr != mState->mEntries.end())
+		{
+			itr->second.mIsQuerying = false;
+		}
+	}
+}
+
+
+
+
+
+void DnsCache::flush()
+{
+	std::lock_guard<std::mutex> lock(mState->mMtx);
+	mState->mEntries.clear();
+	++mState->mGeneration;
+}
+
+
+
+
+
+DnsCache::Stats DnsCache::stats() const
+{
+	std::lock_guard<std::mutex> lock(mState->mMtx);
+	return {
+		mNumHits.load(), mNumMisses.load(), mNumRefreshes.load(),
+		mState->mNumQueries.load(), mState->mNumFailures.load(), mState->mEntries.size()
+	};
+}
+
+
+
+
+
+bool DnsCache::isAddressLiteral(std::wstring_view aServerName)
+{
+	if (aServerName.find_first_of(L":[") != std::wstring_view::npos)
+	{
+		return true;  // IPv6
+	}
+	return (
+		!aServerName.empty() &&
+		std::all_of(aServerName.begin(), aServerName.end(), [](wchar_t aCh)
+			{
+				return (((aCh >= L'0') && (aCh <= L'9')) || (aCh == L'.'));
+			}
+		)
+	);
+}
+
+
+
+
+
+DnsCache::Resolution DnsCache::queryDns(const std::wstring & aServerName, bool aIsRefresh)
+{
+	Resolution res{0, MAX_TTL};
+	PDNS_RECORD records = nullptr;
+	auto options = aIsRefresh ? DNS_QUERY_BYPASS_CACHE : DNS_QUERY_NO_WIRE_QUERY;
+	auto status = DnsQuery_W(aServerName.c_str(), DNS_TYPE_A, options, nullptr, &records, nullptr);
+	if (status == 0)
+	{
+		for (auto rec = records; rec != nullptr; rec = rec->pNext)
+		{
+			if (rec->wType == DNS_TYPE_A)  // Skip the CNAME chain leading to the addresses
+			{
+				res.mTtl = std::min(res.mTtl, std::chrono::seconds(rec->dwTtl));
+			}
+		}
+	}
+	else if (status != DNS_INFO_NO_RECORDS)
+	{
+		// A server with no IPv4 address has nothing to refresh, anything else is a failure:
+		res.mError = status;
+	}
+	if (records != nullptr)
+	{
+		DnsRecordListFree(records, DnsFreeRecordList);
+	}
+	return res;
+}
+
+
+
+
+
+void DnsCache::launchDetached(std::function<void()> && aTask)
+{
+	std::thread(std::move(aTask)).detach();
+}
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
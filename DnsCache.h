@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** A refresh-ahead prefetcher for the names of the servers that the requests use.
+The requests always connect by the server name and let WinHttp resolve it through the system resolver; the cache
+never changes where they connect, nor does it make them wait. It only learns the TTL of each name in use (from the
+system resolver cache, without a network query), and when a request uses a name during the last part of its TTL,
+re-queries the name from the DNS server in the background. A failed query simply drops the name's entry.
+What the refresh gains depends on the DNS Client service: the refresh query bypasses the system resolver cache, and
+it isn't documented whether its answer replaces the record that WinHttp's own resolution then finds there.
+The cache is disabled by default, prefetch() isn't supposed to be called then. */
+class DnsCache
+{
+public:
+
+	/** The result of a single resolution, as returned by a Resolver. */
+	struct Resolution
+	{
+		/** The DNS_STATUS of the failed resolution, or 0 on success. */
+		long mError;
+
+		/** The (remaining) time to live of the resolved addresses. Ignored on failure. */
+		std::chrono::seconds mTtl;
+	};
+
+	/** Resolves the server name. If aIsRefresh is false, only looks into the system resolver cache, in order to learn
+	the remaining TTL without any network traffic; if true, queries the DNS server, bypassing the cache. */
+	using Resolver = std::function<Resolution(const std::wstring & aServerName, bool aIsRefresh)>;
+
+	/** Runs the task in the background. */
+	using Launcher = std::function<void(std::function<void()> && aTask)>;
+
+	/** Returns the current time. */
+	using Clock = std::function<std::chrono::steady_clock::time_point()>;
+
+
+private:
+
+	/** A single tracked name. */
+	struct Entry
+	{
+		/** The time to live, as reported by the resolver (clamped). */
+		std::chrono::seconds mTtl;
+
+		/** The time when the entry expires. Already expired while the first query is in progress. */
+		std::chrono::steady_clock::time_point mExpiry;
+
+		/** Set while a query of the entry is in progress, so that only one is started. */
+		bool mIsQuerying;
+	};
+
+	/** The entries and everything else that the background queries touch. Shared with the queries, so that
+	they can run detached and finish even after the cache has been destroyed. */
+	struct State
+	{
+		/** Resolves the names. */
+		Resolver mResolver;
+
+		/** Provides the current time. */
+		Clock mClock;
+
+		/** Protects mEntries and mGeneration. */
+		std::mutex mMtx;
+
+		/** The tracked entries, by the (lowercase) server name. */
+		std::map<std::wstring, Entry, std::less<>> mEntries;
+
+		/** Incremented by flush(), so that the background queries started before it don't store their results. */
+		std::uint64_t mGeneration = 0;
+
+		/** The number of queries that completed. */
+		std::atomic<std::uint64_t> mNumQueries{0};
+
+		/** The number of queries that failed. */
+		std::atomic<std::uint64_t> mNumFailures{0};
+	};
+
+	/** The shared state of the cache. */
+	std::shared_ptr<State> mState;
+
+	/** Starts the background queries. */
+	Launcher mLauncher;
+
+	/** If false, the requests don't use the cache. */
+	std::atomic<bool> mIsEnabled;
+
+	/** The number of prefetch() calls that found a valid entry. */
+	std::atomic<std::uint64_t> mNumHits;
+
+	/** The number of prefetch() calls that found no valid entry. */
+	std::atomic<std::uint64_t> mNumMisses;
+
+	/** The number of background refreshes started. */
+	std::atomic<std::uint64_t> mNumRefreshes;
+
+
+	/** Resolves the server name and updates its entry, unless the cache has been flushed since aGeneration.
+	A failed resolution removes the entry. */
+	static void query(State & aState, const std::wstring & aServerName, bool aIsRefresh, std::uint64_t aGeneration);
+
+
+public:
+
+	/** The TTLs reported by the resolver are clamped into this range. */
+	static constexpr std::chrono::seconds MIN_TTL{1};
+	static constexpr std::chrono::seconds MAX_TTL{3600};
+
+	/** The part of the TTL before the expiry (1 / REFRESH_AHEAD_DIVISOR) during which a used entry is refreshed. */
+	static constexpr int REFRESH_AHEAD_DIVISOR = 10;
+
+	/** The DnsCache statistics, see stats(). */
+	struct Stats
+	{
+		std::uint64_t mNumHits;
+		std::uint64_t mNumMisses;
+		std::uint64_t mNumRefreshes;
+		std::uint64_t mNumQueries;
+		std::uint64_t mNumFailures;
+		size_t mNumEntries;
+	};
+
+
+	/** Creates an empty cache that resolves the names using aResolver, on the background tasks started by aLauncher,
+	and takes the time from aClock. The defaults use the system resolver, detached threads and the steady clock;
+	the self-test uses stubs. */
+	DnsCache(
+		Resolver aResolver = &DnsCache::queryDns,
+		Launcher aLauncher = &DnsCache::launchDetached,
+		Clock aClock = []() { return std::chrono::steady_clock::now(); }
+	);
+
+	DnsCache(const DnsCache &) = delete;
+	DnsCache & operator = (const DnsCache &) = delete;
+
+	/** Sets whether the requests should use the cache. */
+	void setEnabled(bool aIsEnabled) { mIsEnabled = aIsEnabled; }
+
+	/** Returns true if the requests should use the cache. */
+	bool isEnabled() const { return mIsEnabled; }
+
+	/** Notes that a request is about to connect to the server. If the name has no valid entry, starts learning its
+	TTL in the background; if the entry is in the last part of its TTL, starts refreshing it in the background.
+	Never waits for the resolver. */
+	void prefetch(std::wstring_view aServerName);
+
+	/** Removes all the entries. */
+	void flush();
+
+	/** Returns the statistics of the cache. */
+	Stats stats() const;
+
+	/** Returns true if the server name is an IPv4 or IPv6 address literal, which needs no resolution. */
+	static bool isAddressLiteral(std::wstring_view aServerName);
+
+	/** The default Resolver: queries the IPv4 addresses of the server through DnsQuery_W(), with
+	DNS_QUERY_NO_WIRE_QUERY or DNS_QUERY_BYPASS_CACHE. A server with no IPv4 address resolves with MAX_TTL. */
+	static Resolution queryDns(const std::wstring & aServerName, bool aIsRefresh);
+
+	/** The default Launcher: runs the task on a detached thread. */
+	static void launchDetached(std::function<void()> && aTask);
+};
+
+}
@@ -0,0 +1,367 @@
+#include "Download.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <filesystem>
+#include <thread>
+
+#include <fmt/format.h>
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** The smallest segment size worth a separate connection.
+Smaller resources are downloaded in fewer segments, or in a single stream. */
+static const std::uint64_t MIN_SEGMENT_SIZE = 1024 * 1024;
+
+/** The maximum number of concurrent segments. */
+static const unsigned MAX_SEGMENTS = 16;
+
+
+
+
+
+/** Thrown from a segment's body sink when the server sends more data than the requested range.
+This means that the server ignored the Range header and is sending the entire resource. */
+class RangeNotHonoredException:
+	public Exception
+{
+	using Super = Exception;
+
+
+public:
+
+	RangeNotHonoredException():
+		Super("The server sent more data than the requested range.")
+	{
+	}
+};
+
+
+
+
+
+/** A simple RAII wrapper around a file handle opened for positional writing.
+Writes at explicit offsets, so it can be shared by multiple threads writing different parts of the file.
+The data is written into a temporary file next to the destination file, which only replaces the destination
+in commit(); if the object is destroyed without a commit, the temporary file is deleted and the destination
+is left untouched. */
+class OutputFile
+{
+	HANDLE mHandle;
+
+	/** The name of the destination file (UTF-8), for error messages. */
+	std::string mFileName;
+
+	/** The destination file path. */
+	std::wstring mPath;
+
+	/** The temporary file path, into which the data is written until commit(). */
+	std::wstring mTempPath;
+
+
+public:
+
+	/** Creates a temporary file for the specified destination file (UTF-8 path).
+	Throws an Exception on error. */
+	OutputFile(const std::string & aFileName):
+		mFileName(aFileName),
+		mPath(std::filesystem::u8path(aFileName).wstring())
+	{
+		// Create the temporary file in the same directory, so that it can be renamed over the destination:
+		auto dir = std::filesystem::u8path(aFileName).parent_path();
+		if (dir.empty())
+		{
+			dir = L".";
+		}
+		wchar_t tempPath[MAX_PATH + 1];
+		if (GetTempFileNameW(dir.wstring().c_str(), L"lsw", 0, tempPath) == 0)
+		{
+			throw Exception(fmt::format("Failed to create a temporary file for \"{}\", GetTempFileNameW() failed with error code 0x{:x}.", aFileName, GetLastError()));
+		}
+		mTempPath = tempPath;
+		mHandle = CreateFileW(mTempPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (mHandle == INVALID_HANDLE_VALUE)
+		{
+			auto err = GetLastError();
+			DeleteFileW(mTempPath.c_str());
+			throw Exception(fmt::format("Failed to create a temporary file for \"{}\", CreateFileW() failed with error code 0x{:x}.", aFileName, err));
+		}
+	}
+
+	~OutputFile()
+	{
+		if (mHandle != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(mHandle);
+			DeleteFileW(mTempPath.c_str());
+		}
+	}
+
+	OutputFile(const OutputFile &) = delete;
+	OutputFile & operator = (const OutputFile &) = delete;
+
+	/** Sets the file size, preallocating the space for the writes.
+	Throws an Exception on error. */
+	void setSize(std::uint64_t aSize)
+	{
+		LARGE_INTEGER pos;
+		pos.QuadPart = static_cast<LONGLONG>(aSize);
+		if (!SetFilePointerEx(mHandle, pos, nullptr, FILE_BEGIN) || !SetEndOfFile(mHandle))
+		{
+			throw Exception(fmt::format("Failed to set the size of file \"{}\" to {} bytes, error code 0x{:x}.", mFileName, aSize, GetLastError()));
+		}
+	}
+
+	/** Writes the data at the specified offset of the file.
+	Throws an Exception on error. */
+	void writeAt(std::uint64_t aOffset, const char * aData, size_t aSize)
+	{
+		while (aSize > 0)
+		{
+			OVERLAPPED ovl = {};
+			ovl.Offset = static_cast<DWORD>(aOffset & 0xffffffffu);
+			ovl.OffsetHigh = static_cast<DWORD>(aOffset >> 32);
+			DWORD written = 0;
+			if (!WriteFile(mHandle, aData, static_cast<DWORD>(aSize), &written, &ovl) || (written == 0))
+			{
+				throw Exception(fmt::format("Failed to write into file \"{}\" at offset {}, WriteFile() failed with error code 0x{:x}.", mFileName, aOffset, GetLastError()));
+			}
+			aOffset += written;
+			aData += written;
+			aSize -= written;
+		}
+	}
+
+	/** Closes the temporary file and moves it over the destination file.
+	Throws an Exception on error. */
+	void commit()
+	{
+		CloseHandle(mHandle);
+		mHandle = INVALID_HANDLE_VALUE;
+		if (!MoveFileExW(mTempPath.c_str(), mPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			auto err = GetLastError();
+			DeleteFileW(mTempPath.c_str());
+			throw Exception(fmt::format("Failed to replace file \"{}\" with the downloaded data, MoveFileExW() failed with error code 0x{:x}.", mFileName, err));
+		}
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Download:
+
+Download::Download(Client & aClient, std::string && aUrl, std::string && aFileName):
+	mClient(aClient),
+	mUrl(std::move(aUrl)),
+	mFileName(std::move(aFileName)),
+	mNumSegments(1),
+	mNumRetries(2),
+	mBytesWritten(0)
+{
+}
+
+
+
+
+
+void Download::prepareRequest(Request & aRequest) const
+{
+	aRequest.setUrl(std::string(mUrl));
+	for (const auto & hdr: mAdditionalHeaders)
+	{
+		aRequest.addHeader(hdr);
+	}
+}
+
+
+
+
+
+Response Download::downloadSingle()
+{
+	OutputFile file(mFileName);
+	mBytesWritten = 0;
+	Request req(mClient, "GET");
+	prepareRequest(req);
+	req.setBodySink([this, &file](const char * aData, size_t aSize)
+		{
+			file.writeAt(mBytesWritten, aData, aSize);
+			mBytesWritten += aSize;
+		}
+	);
+	auto resp = req.make();
+	if ((resp.mStatusCode < 200) || (resp.mStatusCode >= 300))
+	{
+		// Don't replace the file with an error page:
+		mBytesWritten = 0;
+		throw Exception(fmt::format("The server responded with status {} {}, the file \"{}\" was not written.", resp.mStatusCode, resp.mStatusText, mFileName));
+	}
+	file.commit();
+	return resp;
+}
+
+
+
+
+
+void Download::downloadSegmented(std::uint64_t aTotalSize)
+{
+	OutputFile file(mFileName);
+	file.setSize(aTotalSize);
+
+	auto numSegments = static_cast<unsigned>(std::min<std::uint64_t>(mNumSegments, aTotalSize / MIN_SEGMENT_SIZE));
+	auto segmentSize = aTotalSize / numSegments;
+	std::atomic<bool> isRangeNotHonored(false);
+	std::vector<std::string> errors(numSegments);
+	std::vector<std::thread> threads;
+	threads.reserve(numSegments);
+	try
+	{
+		for (unsigned i = 0; i < numSegments; ++i)
+		{
+			auto start = segmentSize * i;
+			auto end = (i + 1 == numSegments) ? aTotalSize : (start + segmentSize);  // One past the last byte
+			threads.emplace_back([this, &file, &isRangeNotHonored, &error = errors[i], start, end]()
+				{
+					std::uint64_t pos = start;
+					for (unsigned attempt = 0;; ++attempt)
+					{
+						try
+						{
+							// Request the remaining part of the segment; on a retry this resumes where the previous attempt failed:
+							Request req(mClient, "GET");
+							prepareRequest(req);
+							req.addHeader(fmt::format("Range: bytes={}-{}", pos, end - 1));
+							req.setBodySink([&file, &pos, end](const char * aData, size_t aSize)
+								{
+									if (pos + aSize > end)
+									{
+										throw RangeNotHonoredException();
+									}
+									file.writeAt(pos, aData, aSize);
+									pos += aSize;
+								}
+							);
+							auto resp = req.make();
+							if (resp.mStatusCode == 200)
+							{
+								// The entire resource fit into the segment, the server still didn't honor the range
+								throw RangeNotHonoredException();
+							}
+							if (resp.mStatusCode != 206)
+							{
+								throw Exception(fmt::format("Unexpected status code {} for a range request.", resp.mStatusCode));
+							}
+							if (pos == end)
+							{
+								return;
+							}
+							throw Exception(fmt::format("The server sent only {} of the {} requested bytes.", pos - start, end - start));
+						}
+						catch (const RangeNotHonoredException &)
+						{
+							isRangeNotHonored = true;
+							return;
+						}
+						catch (const std::exception & exc)
+						{
+							// Any exception escaping the thread would terminate the process, catch them all
+							if (isRangeNotHonored || (attempt >= mNumRetries))
+							{
+								error = fmt::format("Failed to download bytes {}-{}: {}", start, end - 1, exc.what());
+								return;
+							}
+						}
+					}
+				}
+			);
+		}
+	}
+	catch (...)
+	{
+		// Failed to start a thread; the started ones must be joined before their std::thread objects are destroyed:
+		for (auto & thr: threads)
+		{
+			thr.join();
+		}
+		throw;
+	}
+	for (auto & thr: threads)
+	{
+		thr.join();
+	}
+
+	if (isRangeNotHonored)
+	{
+		throw RangeNotHonoredException();
+	}
+	for (const auto & error: errors)
+	{
+		if (!error.empty())
+		{
+			throw Exception(std::string(error));
+		}
+	}
+	file.commit();
+	mBytesWritten = aTotalSize;
+}
+
+
+
+
+
+Response Download::make()
+{
+	if (mNumSegments <= 1)
+	{
+		return downloadSingle();
+	}
+
+	// Probe the resource for its size and range support:
+	Request head(mClient, "HEAD");
+	prepareRequest(head);
+	auto resp = head.make();
+	std::uint64_t totalSize = 0;
+	auto contentLength = resp.header("Content-Length");
+	auto [ptr, ec] = std::from_chars(contentLength.data(), contentLength.data() + contentLength.size(), totalSize);
+	if (
+		(resp.mStatusCode != 200) ||
+		(ec != std::errc()) ||
+		(resp.header("Accept-Ranges") != "bytes") ||
+		(totalSize < 2 * MIN_SEGMENT_SIZE)
+	)
+	{
+		return downloadSingle();
+	}
+
+	mNumSegments = std::min(mNumSegments, MAX_SEGMENTS);
+	try
+	{
+		downloadSegmented(totalSize);
+	}
+	catch (const RangeNotHonoredException &)
+	{
+		return downloadSingle();
+	}
+	return resp;
+}
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
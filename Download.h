@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Request.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** Represents a single download of a resource into a file.
+If more than one segment is requested, the resource is first probed with a HEAD request; if the server reports
+its Content-Length and supports byte ranges, the file is preallocated and the individual byte ranges are downloaded
+concurrently, each over its own connection, and written directly to their place in the file. Otherwise
+(or with a single segment) the resource is downloaded as a single stream.
+Usage is the same as with Request: create, set up, call make() once. */
+class Download
+{
+	/** The client through which the requests are made. */
+	Client & mClient;
+
+	/** The URL of the resource to download. */
+	std::string mUrl;
+
+	/** The path (UTF-8) of the file into which the resource is written. */
+	std::string mFileName;
+
+	/** The additional headers to add to each request, in the "Name: Value" form. */
+	std::vector<std::string> mAdditionalHeaders;
+
+	/** The number of segments to download concurrently. */
+	unsigned mNumSegments;
+
+	/** The number of times each segment is retried after a failure. */
+	unsigned mNumRetries;
+
+	/** The number of bytes written into the file. */
+	std::uint64_t mBytesWritten;
+
+
+	/** Sets up the request's URL and all the additional headers. */
+	void prepareRequest(Request & aRequest) const;
+
+	/** Downloads the entire resource in a single stream into the file.
+	Returns the response of the GET request. Throws an Exception if the response status is not 2xx. */
+	Response downloadSingle();
+
+	/** Downloads the resource of the specified total size in mNumSegments concurrent byte-range segments into the file.
+	Throws an Exception if any of the segments fails even after mNumRetries retries. */
+	void downloadSegmented(std::uint64_t aTotalSize);
+
+
+public:
+
+	/** Creates a new download of the specified URL into the specified file (UTF-8 path). */
+	Download(Client & aClient, std::string && aUrl, std::string && aFileName);
+
+	/** Adds an additional header to all the requests, in the "Name: Value" form. */
+	void addHeader(std::string_view aHeader) { mAdditionalHeaders.emplace_back(aHeader); }
+
+	/** Sets the number of segments to download concurrently. Values less than 1 are treated as 1. */
+	void setNumSegments(unsigned aNumSegments) { mNumSegments = aNumSegments; }
+
+	/** Sets the number of times each segment is retried after a failure. */
+	void setNumRetries(unsigned aNumRetries) { mNumRetries = aNumRetries; }
+
+	/** Returns the number of bytes written into the file by make(). */
+	std::uint64_t bytesWritten() const { return mBytesWritten; }
+
+	/** Downloads the resource into the file.
+	The data is downloaded into a temporary file, which replaces the file only once the download succeeds; on any
+	error, including a non-2xx response status, the file is left untouched.
+	Returns the response describing the resource (of the HEAD request for segmented downloads, of the GET request
+	otherwise), with an empty body. Throws an Exception on error. */
+	Response make();
+};
+
+}
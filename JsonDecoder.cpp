@@ -0,0 +1,590 @@
+#include "JsonDecoder.h"
+
+#include <cassert>
+#include <charconv>
+#include <limits>
+#include <string>
+
+#include <fmt/format.h>
+
+extern "C"
+{
+	#include <lua.h>
+	#include <lauxlib.h>
+}
+
+#include "Request.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** The maximum nesting depth of arrays and objects accepted by the decoder.
+Protects the C stack from maliciously deep documents. */
+static const int MAX_JSON_DEPTH = 512;
+
+
+
+
+
+/** Single-use recursive-descent decoder that pushes the decoded values directly onto a Lua stack. */
+class JsonDecoder
+{
+	/** The Lua state onto which the values are pushed. */
+	lua_State * mState;
+
+	/** The start of the document, used for reporting error positions. */
+	const char * mStart;
+
+	/** The current parsing position. */
+	const char * mCur;
+
+	/** The end of the document. */
+	const char * mEnd;
+
+	/** The current nesting depth of arrays and objects. */
+	int mDepth;
+
+	/** Buffer reused for unescaping the strings that contain escape sequences. */
+	std::string mScratch;
+
+
+	/** Throws an Exception with the specified message, decorated with the current position. */
+	[[noreturn]] void fail(const char * aMessage)
+	{
+		throw Exception(fmt::format("Failed to decode the JSON response at offset {}: {}", mCur - mStart, aMessage));
+	}
+
+
+	/** Advances mCur past any whitespace. */
+	void skipWhitespace()
+	{
+		while ((mCur < mEnd) && ((*mCur == ' ') || (*mCur == '\n') || (*mCur == '\r') || (*mCur == '\t')))
+		{
+			++mCur;
+		}
+	}
+
+
+	/** Consumes the specified literal (true, false, null) or throws if it is not present at mCur. */
+	void expectLiteral(const char * aLiteral, size_t aLength)
+	{
+		if ((static_cast<size_t>(mEnd - mCur) < aLength) || (std::char_traits<char>::compare(mCur, aLiteral, aLength) != 0))
+		{
+			fail("Invalid literal");
+		}
+		mCur += aLength;
+	}
+
+
+	/** Reads four hex digits of a \u escape and returns their value. */
+	unsigned readHex4()
+	{
+		if (mEnd - mCur < 4)
+		{
+			fail("Truncated \\u escape");
+		}
+		unsigned res = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			auto c = *mCur++;
+			res <<= 4;
+			if ((c >= '0') && (c <= '9'))
+			{
+				res |= static_cast<unsigned>(c - '0');
+			}
+			else if ((c >= 'a') && (c <= 'f'))
+			{
+				res |= static_cast<unsigned>(c - 'a' + 10);
+			}
+			else if ((c >= 'A') && (c <= 'F'))
+			{
+				res |= static_cast<unsigned>(c - 'A' + 10);
+			}
+			else
+			{
+				fail("Invalid hex digit in a \\u escape");
+			}
+		}
+		return res;
+	}
+
+
+	/** Appends the specified codepoint to mScratch, encoded as UTF-8. */
+	void appendUtf8(unsigned aCodepoint)
+	{
+		if (aCodepoint < 0x80)
+		{
+			mScratch.push_back(static_cast<char>(aCodepoint));
+		}
+		else if (aCodepoint < 0x800)
+		{
+			mScratch.push_back(static_cast<char>(0xc0 | (aCodepoint >> 6)));
+			mScratch.push_back(static_cast<char>(0x80 | (aCodepoint & 0x3f)));
+		}
+		else if (aCodepoint < 0x10000)
+		{
+			mScratch.push_back(static_cast<char>(0xe0 | (aCodepoint >> 12)));
+			mScratch.push_back(static_cast<char>(0x80 | ((aCodepoint >> 6) & 0x3f)));
+			mScratch.push_back(static_cast<char>(0x80 | (aCodepoint & 0x3f)));
+		}
+		else
+		{
+			mScratch.push_back(static_cast<char>(0xf0 | (aCodepoint >> 18)));
+			mScratch.push_back(static_cast<char>(0x80 | ((aCodepoint >> 12) & 0x3f)));
+			mScratch.push_back(static_cast<char>(0x80 | ((aCodepoint >> 6) & 0x3f)));
+			mScratch.push_back(static_cast<char>(0x80 | (aCodepoint & 0x3f)));
+		}
+	}
+
+
+	/** Decodes the string starting at mCur (just after the opening quote) and pushes it onto the Lua stack.
+	Strings without escape sequences are pushed straight from the document buffer. */
+	void pushString()
+	{
+		// Fast path: scan for the closing quote; if there are no escapes, push directly from the buffer:
+		auto start = mCur;
+		while ((mCur < mEnd) && (*mCur != '"') && (*mCur != '\\'))
+		{
+			if (static_cast<unsigned char>(*mCur) < 0x20)
+			{
+				fail("Unescaped control character in a string");
+			}
+			++mCur;
+		}
+		if (mCur >= mEnd)
+		{
+			fail("Unterminated string");
+		}
+		if (*mCur == '"')
+		{
+			lua_pushlstring(mState, start, static_cast<size_t>(mCur - start));
+			++mCur;
+			return;
+		}
+
+		// Slow path: there are escapes, unescape into mScratch:
+		mScratch.assign(start, mCur);
+		while (true)
+		{
+			if (mCur >= mEnd)
+			{
+				fail("Unterminated string");
+			}
+			auto c = *mCur++;
+			if (c == '"')
+			{
+				break;
+			}
+			if (c != '\\')
+			{
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					fail("Unescaped control character in a string");
+				}
+				mScratch.push_back(c);
+				continue;
+			}
+			if (mCur >= mEnd)
+			{
+				fail("Unterminated escape sequence");
+			}
+			switch (*mCur++)
+			{
+				case '"':  mScratch.push_back('"');  break;
+				case '\\': mScratch.push_back('\\'); break;
+				case '/':  mScratch.push_back('/');  break;
+				case 'b':  mScratch.push_back('\b'); break;
+				case 'f':  mScratch.push_back('\f'); break;
+				case 'n':  mScratch.push_back('\n'); break;
+				case 'r':  mScratch.push_back('\r'); break;
+				case 't':  mScratch.push_back('\t'); break;
+				case 'u':
+				{
+					auto codepoint = readHex4();
+					if ((codepoint >= 0xd800) && (codepoint <= 0xdbff))
+					{
+						// A high surrogate, must be followed by a low surrogate:
+						if ((mEnd - mCur < 2) || (mCur[0] != '\\') || (mCur[1] != 'u'))
+						{
+							fail("Unpaired surrogate in a \\u escape");
+						}
+						mCur += 2;
+						auto low = readHex4();
+						if ((low < 0xdc00) || (low > 0xdfff))
+						{
+							fail("Invalid low surrogate in a \\u escape");
+						}
+						codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+					}
+					else if ((codepoint >= 0xdc00) && (codepoint <= 0xdfff))
+					{
+						fail("Unpaired surrogate in a \\u escape");
+					}
+					appendUtf8(codepoint);
+					break;
+				}
+				default:
+				{
+					fail("Invalid escape sequence");
+				}
+			}
+		}
+		lua_pushlstring(mState, mScratch.data(), mScratch.size());
+	}
+
+
+	/** Decodes the number starting at mCur and pushes it onto the Lua stack.
+	Integers that fit into lua_Integer are pushed as integers, everything else as lua_Number. */
+	void pushNumber()
+	{
+		auto start = mCur;
+		bool isInteger = true;
+		if ((mCur < mEnd) && (*mCur == '-'))
+		{
+			++mCur;
+		}
+		if ((mCur >= mEnd) || (*mCur < '0') || (*mCur > '9'))
+		{
+			fail("Invalid number");
+		}
+		if (*mCur == '0')
+		{
+			++mCur;
+		}
+		else
+		{
+			while ((mCur < mEnd) && (*mCur >= '0') && (*mCur <= '9'))
+			{
+				++mCur;
+			}
+		}
+		if ((mCur < mEnd) && (*mCur == '.'))
+		{
+			isInteger = false;
+			++mCur;
+			if ((mCur >= mEnd) || (*mCur < '0') || (*mCur > '9'))
+			{
+				fail("Invalid number, expected a digit after the decimal point");
+			}
+			while ((mCur < mEnd) && (*mCur >= '0') && (*mCur <= '9'))
+			{
+				++mCur;
+			}
+		}
+		if ((mCur < mEnd) && ((*mCur == 'e') || (*mCur == 'E')))
+		{
+			isInteger = false;
+			++mCur;
+			if ((mCur < mEnd) && ((*mCur == '+') || (*mCur == '-')))
+			{
+				++mCur;
+			}
+			if ((mCur >= mEnd) || (*mCur < '0') || (*mCur > '9'))
+			{
+				fail("Invalid number, expected a digit in the exponent");
+			}
+			while ((mCur < mEnd) && (*mCur >= '0') && (*mCur <= '9'))
+			{
+				++mCur;
+			}
+		}
+
+		if (isInteger)
+		{
+			long long value;
+			auto [ptr, ec] = std::from_chars(start, mCur, value);
+			if (
+				(ec == std::errc()) &&
+				(value >= static_cast<long long>(std::numeric_limits<lua_Integer>::min())) &&
+				(value <= static_cast<long long>(std::numeric_limits<lua_Integer>::max()))
+			)
+			{
+				lua_pushinteger(mState, static_cast<lua_Integer>(value));
+				return;
+			}
+			// Out of range for an integer, fall back to a floating point number
+		}
+		double value;
+		auto [ptr, ec] = std::from_chars(start, mCur, value);
+		if (ec != std::errc())
+		{
+			fail("Number out of range");
+		}
+		lua_pushnumber(mState, static_cast<lua_Number>(value));
+	}
+
+
+	/** Decodes the array starting at mCur (just after the opening bracket) and pushes it onto the Lua stack as a table. */
+	void pushArray()
+	{
+		lua_newtable(mState);
+		skipWhitespace();
+		if ((mCur < mEnd) && (*mCur == ']'))
+		{
+			++mCur;
+			return;
+		}
+		for (int idx = 1;; ++idx)
+		{
+			pushValue();
+			lua_rawseti(mState, -2, idx);
+			skipWhitespace();
+			if (mCur >= mEnd)
+			{
+				fail("Unterminated array");
+			}
+			auto c = *mCur++;
+			if (c == ']')
+			{
+				return;
+			}
+			if (c != ',')
+			{
+				fail("Expected a ',' or ']' in an array");
+			}
+		}
+	}
+
+
+	/** Decodes the object starting at mCur (just after the opening brace) and pushes it onto the Lua stack as a table. */
+	void pushObject()
+	{
+		lua_newtable(mState);
+		skipWhitespace();
+		if ((mCur < mEnd) && (*mCur == '}'))
+		{
+			++mCur;
+			return;
+		}
+		while (true)
+		{
+			skipWhitespace();
+			if ((mCur >= mEnd) || (*mCur != '"'))
+			{
+				fail("Expected a string key in an object");
+			}
+			++mCur;
+			pushString();
+			skipWhitespace();
+			if ((mCur >= mEnd) || (*mCur != ':'))
+			{
+				fail("Expected a ':' after an object key");
+			}
+			++mCur;
+			pushValue();
+			lua_rawset(mState, -3);
+			skipWhitespace();
+			if (mCur >= mEnd)
+			{
+				fail("Unterminated object");
+			}
+			auto c = *mCur++;
+			if (c == '}')
+			{
+				return;
+			}
+			if (c != ',')
+			{
+				fail("Expected a ',' or '}' in an object");
+			}
+		}
+	}
+
+
+	/** Decodes any single value starting at mCur (after optional whitespace) and pushes it onto the Lua stack. */
+	void pushValue()
+	{
+		skipWhitespace();
+		if (mCur >= mEnd)
+		{
+			fail("Unexpected end of document");
+		}
+		switch (*mCur)
+		{
+			case '{':
+			case '[':
+			{
+				if (++mDepth > MAX_JSON_DEPTH)
+				{
+					fail("Nesting too deep");
+				}
+				if (!lua_checkstack(mState, 3))
+				{
+					fail("Lua stack exhausted");
+				}
+				if (*mCur++ == '{')
+				{
+					pushObject();
+				}
+				else
+				{
+					pushArray();
+				}
+				--mDepth;
+				return;
+			}
+			case '"':
+			{
+				++mCur;
+				pushString();
+				return;
+			}
+			case 't':
+			{
+				expectLiteral("true", 4);
+				lua_pushboolean(mState, 1);
+				return;
+			}
+			case 'f':
+			{
+				expectLiteral("false", 5);
+				lua_pushboolean(mState, 0);
+				return;
+			}
+			case 'n':
+			{
+				expectLiteral("null", 4);
+				lua_pushlightuserdata(mState, nullptr);
+				return;
+			}
+			default:
+			{
+				pushNumber();
+				return;
+			}
+		}
+	}
+
+
+public:
+
+	JsonDecoder(lua_State * aState, const char * aData, size_t aSize):
+		mState(aState),
+		mStart(aData),
+		mCur(aData),
+		mEnd(aData + aSize),
+		mDepth(0)
+	{
+	}
+
+
+	/** Decodes the whole document and pushes the resulting value onto the Lua stack. */
+	void decode()
+	{
+		pushValue();
+		skipWhitespace();
+		if (mCur != mEnd)
+		{
+			fail("Unexpected data after the end of the document");
+		}
+	}
+};
+
+
+
+
+
+void pushJson(lua_State * aState, const char * aData, size_t aSize)
+{
+	auto top = lua_gettop(aState);
+	try
+	{
+		JsonDecoder(aState, aData, aSize).decode();
+	}
+	catch (...)
+	{
+		// Remove the partially-decoded values from the stack:
+		lua_settop(aState, top);
+		throw;
+	}
+}
+
+
+
+
+
+#ifdef _DEBUG
+struct TestJsonDecoder
+{
+	TestJsonDecoder()
+	{
+		auto state = luaL_newstate();
+		testString(state, R"("plain")",               "plain");
+		testString(state, R"("a\tb\u00e9")",          "a\tb\xc3\xa9");
+		testString(state, R"("\ud83d\ude00")",        "\xf0\x9f\x98\x80");  // Surrogate pair
+		testNumber(state, "42",                       42);
+		testNumber(state, "-1.5e3",                   -1500);
+		testNumber(state, "123456789012345678901234", 123456789012345678901234.0);  // Integer overflow falls back to double
+		testNesting(state, MAX_JSON_DEPTH);
+		testFails(state, R"("\ud83d")");       // Unpaired high surrogate
+		testFails(state, R"("\ude00")");       // Unpaired low surrogate
+		testFails(state, R"("\ud83d\u0041")"); // Invalid low surrogate
+		testFails(state, "1 2");               // Trailing data
+		testFails(state, "{} x");
+		testFails(state, "[1,]");
+		testFails(state, "01");
+		testFails(state, std::string(MAX_JSON_DEPTH + 1, '[') + std::string(MAX_JSON_DEPTH + 1, ']'));  // Too deep
+		lua_close(state);
+	}
+
+	/** Asserts that the document decodes into the expected string. */
+	void testString(lua_State * aState, const std::string & aJson, const std::string & aExpected)
+	{
+		pushJson(aState, aJson.data(), aJson.size());
+		assert(lua_type(aState, -1) == LUA_TSTRING);
+		size_t len = 0;
+		auto str = lua_tolstring(aState, -1, &len);
+		assert(std::string(str, len) == aExpected);
+		lua_pop(aState, 1);
+	}
+
+	/** Asserts that the document decodes into the expected number. */
+	void testNumber(lua_State * aState, const std::string & aJson, lua_Number aExpected)
+	{
+		pushJson(aState, aJson.data(), aJson.size());
+		assert(lua_type(aState, -1) == LUA_TNUMBER);
+		assert(lua_tonumber(aState, -1) == aExpected);
+		lua_pop(aState, 1);
+	}
+
+	/** Asserts that arrays nested aDepth levels deep are decoded. */
+	void testNesting(lua_State * aState, int aDepth)
+	{
+		auto json = std::string(static_cast<size_t>(aDepth), '[') + std::string(static_cast<size_t>(aDepth), ']');
+		pushJson(aState, json.data(), json.size());
+		assert(lua_type(aState, -1) == LUA_TTABLE);
+		lua_pop(aState, 1);
+	}
+
+	/** Asserts that decoding the document throws and leaves the Lua stack untouched. */
+	void testFails(lua_State * aState, const std::string & aJson)
+	{
+		auto top = lua_gettop(aState);
+		bool hasThrown = false;
+		try
+		{
+			pushJson(aState, aJson.data(), aJson.size());
+		}
+		catch (const Exception &)
+		{
+			hasThrown = true;
+		}
+		assert(hasThrown);
+		assert(lua_gettop(aState) == top);
+	}
+} gTestJsonDecoder;
+#endif  // _DEBUG
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
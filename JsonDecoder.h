@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+
+
+
+
+// fwd: lua.h
+struct lua_State;
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** Parses the JSON document in the specified buffer and pushes the decoded value onto the Lua stack.
+Objects and arrays are decoded into Lua tables (arrays are 1-based), strings, numbers and booleans into their Lua
+counterparts. The JSON null is decoded into the lightuserdata NULL (exposed to the scripts as LuaSimpleWinHttp.null),
+so that it can be stored in tables.
+The document is decoded straight from the buffer, it is never materialized as a Lua string.
+Throws an Exception if the document is malformed; nothing is pushed onto the stack in such a case. */
+void pushJson(lua_State * aState, const char * aData, size_t aSize);
+
+}
@@ -0,0 +1,305 @@
+#include "LuaByteBuffer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <string_view>
+
+extern "C"
+{
+	#include <lauxlib.h>
+	#include <lualib.h>  // LUA_FILEHANDLE in Lua 5.1
+}
+
+#include "ByteBuffer.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** The name of the metatable of the byte buffer userdata in the Lua registry. */
+static const char BYTE_BUFFER_METATABLE[] = "LuaSimpleWinHttp.ByteBuffer";
+
+
+
+
+
+/** The contents of the byte buffer userdata: a view of a part of a shared buffer. */
+struct BufferView
+{
+	std::shared_ptr<ByteBuffer> mBuffer;
+
+	/** The start of the view within mBuffer. */
+	size_t mOffset;
+
+	/** The size of the view. */
+	size_t mSize;
+
+
+	/** Returns the viewed data. */
+	std::string_view view() const
+	{
+		return std::string_view(mBuffer->data() + mOffset, mSize);
+	}
+};
+
+
+
+
+
+/** Pushes a new userdata with the specified view onto the Lua stack. */
+static void pushView(lua_State * aState, std::shared_ptr<ByteBuffer> aBuffer, size_t aOffset, size_t aSize)
+{
+	auto mem = lua_newuserdata(aState, sizeof(BufferView));
+	new (mem) BufferView{std::move(aBuffer), aOffset, aSize};
+	luaL_getmetatable(aState, BYTE_BUFFER_METATABLE);
+	lua_setmetatable(aState, -2);
+}
+
+
+
+
+
+/** Returns the view from the byte buffer userdata at the specified stack position.
+Raises a Lua error if there's no byte buffer. */
+static BufferView & checkView(lua_State * aState, int aStackPos)
+{
+	return *static_cast<BufferView *>(luaL_checkudata(aState, aStackPos, BYTE_BUFFER_METATABLE));
+}
+
+
+
+
+
+/** Converts a Lua string index (1-based, negative from the end) into a 0-based offset clamped to [0, aSize].
+Used for the init parameter of find(). */
+static size_t luaIndexToOffset(lua_Integer aIndex, size_t aSize)
+{
+	if (aIndex < 0)
+	{
+		aIndex += static_cast<lua_Integer>(aSize) + 1;
+	}
+	if (aIndex < 1)
+	{
+		return 0;
+	}
+	if (static_cast<size_t>(aIndex) > aSize)
+	{
+		return aSize;
+	}
+	return static_cast<size_t>(aIndex) - 1;
+}
+
+
+
+
+
+static int bufferGc(lua_State * aState)
+{
+	checkView(aState, 1).~BufferView();
+	return 0;
+}
+
+
+
+
+
+static int bufferLen(lua_State * aState)
+{
+	lua_pushnumber(aState, static_cast<lua_Number>(checkView(aState, 1).mSize));
+	return 1;
+}
+
+
+
+
+
+/** buffer:sub(i, j): returns a new view of the bytes i to j (string.sub semantics), without copying. */
+static int bufferSub(lua_State * aState)
+{
+	auto & view = checkView(aState, 1);
+	auto size = static_cast<lua_Integer>(view.mSize);
+	auto first = luaL_checkinteger(aState, 2);
+	auto last = luaL_optinteger(aState, 3, -1);
+	if (first < 0)
+	{
+		first = std::max<lua_Integer>(size + first + 1, 1);
+	}
+	else if (first == 0)
+	{
+		first = 1;
+	}
+	if (last < 0)
+	{
+		last = size + last + 1;
+	}
+	else if (last > size)
+	{
+		last = size;
+	}
+	if (first > last)
+	{
+		pushView(aState, view.mBuffer, view.mOffset, 0);
+	}
+	else
+	{
+		pushView(aState, view.mBuffer, view.mOffset + static_cast<size_t>(first - 1), static_cast<size_t>(last - first + 1));
+	}
+	return 1;
+}
+
+
+
+
+
+/** buffer:find(str, init): plain (no patterns) search for str, starting at the init index.
+Returns the start and end indices of the first occurrence, or nil if not found. */
+static int bufferFind(lua_State * aState)
+{
+	auto & view = checkView(aState, 1);
+	size_t len = 0;
+	auto needle = luaL_checklstring(aState, 2, &len);
+	auto start = luaIndexToOffset(luaL_optinteger(aState, 3, 1), view.mSize);
+	auto pos = view.view().find(std::string_view(needle, len), start);
+	if (pos == std::string_view::npos)
+	{
+		lua_pushnil(aState);
+		return 1;
+	}
+	lua_pushnumber(aState, static_cast<lua_Number>(pos + 1));
+	lua_pushnumber(aState, static_cast<lua_Number>(pos + len));
+	return 2;
+}
+
+
+
+
+
+/** buffer:tostring(): returns the viewed bytes as a Lua string (this is the only method that copies the data). */
+static int bufferToString(lua_State * aState)
+{
+	auto data = checkView(aState, 1).view();
+	lua_pushlstring(aState, data.data(), data.size());
+	return 1;
+}
+
+
+
+
+
+/** buffer:write(file): writes the viewed bytes into a file, specified either by a path or by an open io file handle.
+Returns true on success, nil and an error message on failure. */
+static int bufferWrite(lua_State * aState)
+{
+	auto data = checkView(aState, 1).view();
+	if (lua_type(aState, 2) == LUA_TSTRING)
+	{
+		auto fileName = lua_tostring(aState, 2);
+		bool isWritten = false;
+		std::string error;
+		try
+		{
+			// u8path() throws on an invalid utf8 name, and no exception may escape into Lua:
+			std::ofstream f(std::filesystem::u8path(fileName), std::ios::binary | std::ios::trunc);
+			f.write(data.data(), static_cast<std::streamsize>(data.size()));
+			f.close();
+			isWritten = f.good();
+		}
+		catch (const std::exception & exc)
+		{
+			error = exc.what();
+		}
+		if (!isWritten)
+		{
+			// Pushed outside the try block, a Lua error raised here must not unwind through it:
+			lua_pushnil(aState);
+			if (error.empty())
+			{
+				lua_pushfstring(aState, "Failed to write into file \"%s\".", fileName);
+			}
+			else
+			{
+				lua_pushfstring(aState, "Failed to write into file \"%s\": %s", fileName, error.c_str());
+			}
+			return 2;
+		}
+		lua_pushboolean(aState, 1);
+		return 1;
+	}
+
+	// Both Lua 5.1 (FILE **) and 5.2+ (luaL_Stream) file handles start with the FILE pointer:
+	auto f = *static_cast<FILE **>(luaL_checkudata(aState, 2, LUA_FILEHANDLE));
+	if (f == nullptr)
+	{
+		lua_pushnil(aState);
+		lua_pushstring(aState, "Attempt to write into a closed file.");
+		return 2;
+	}
+	if (fwrite(data.data(), 1, data.size(), f) != data.size())
+	{
+		lua_pushnil(aState);
+		lua_pushstring(aState, "Failed to write into the file.");
+		return 2;
+	}
+	lua_pushboolean(aState, 1);
+	return 1;
+}
+
+
+
+
+
+void registerByteBuffer(lua_State * aState)
+{
+	static const luaL_Reg methods[] =
+	{
+		{"find",     &bufferFind},
+		{"len",      &bufferLen},
+		{"sub",      &bufferSub},
+		{"tostring", &bufferToString},
+		{"write",    &bufferWrite},
+		{nullptr, nullptr},
+	};
+
+	luaL_newmetatable(aState, BYTE_BUFFER_METATABLE);
+	lua_pushcfunction(aState, &bufferGc);
+	lua_setfield(aState, -2, "__gc");
+	lua_pushcfunction(aState, &bufferLen);
+	lua_setfield(aState, -2, "__len");
+	lua_pushcfunction(aState, &bufferToString);
+	lua_setfield(aState, -2, "__tostring");
+	lua_newtable(aState);
+	for (auto method = methods; method->name != nullptr; ++method)
+	{
+		lua_pushcfunction(aState, method->func);
+		lua_setfield(aState, -2, method->name);
+	}
+	lua_setfield(aState, -2, "__index");
+	lua_pop(aState, 1);
+}
+
+
+
+
+
+void pushByteBuffer(lua_State * aState, std::shared_ptr<ByteBuffer> aBuffer)
+{
+	auto size = aBuffer->size();
+	pushView(aState, std::move(aBuffer), 0, size);
+}
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+
+
+
+
+
+// fwd: lua.h
+struct lua_State;
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+// fwd:
+class ByteBuffer;
+
+
+
+
+
+/** Registers the metatable for the byte buffer userdata in the Lua state.
+Must be called before pushByteBuffer() is used on the state. */
+void registerByteBuffer(lua_State * aState);
+
+/** Pushes a userdata representing a view of the entire (finished) buffer onto the Lua stack.
+The userdata keeps the buffer alive; its :sub() views share the same buffer, so no data is ever copied
+until the script explicitly asks for a Lua string by :tostring(). */
+void pushByteBuffer(lua_State * aState, std::shared_ptr<ByteBuffer> aBuffer);
+
+}
@@ -6,24 +6,619 @@ extern "C"
 	#include <lauxlib.h>
 }
 
+#include <algorithm>
+#include <limits>
+
+#include <fmt/format.h>
+
+#include "ByteBuffer.h"
+#include "Download.h"
+#include "JsonDecoder.h"
+#include "LuaByteBuffer.h"
 #include "Request.h"
 
 
 
 
 
+using LuaSimpleWinHttp::Client;
+using LuaSimpleWinHttp::Exception;
+using LuaSimpleWinHttp::Request;
+using LuaSimpleWinHttp::Response;
+
+
+
+
+
+/** The options from the parameter table that are handled by the Lua bindings rather than the Request itself. */
+struct LuaOptions
+{
+	/** If true, the response body is decoded as JSON into Lua values instead of being returned as a string. */
+	bool mDecodeJson = false;
+
+	/** If set, the response body is received into this buffer and returned as a byte buffer userdata instead of a string. */
+	std::shared_ptr<LuaSimpleWinHttp::ByteBuffer> mBodyBuffer;
+};
+
+
+
+
+
+/** A simple RAII class that pops one value off the Lua stack upon leaving the scope. */
+class LuaPopper
+{
+	/** The Lua state from which the value shall be popped. */
+	lua_State * mState;
+
+
+public:
+	LuaPopper(lua_State * aState):
+		mState(aState)
+	{
+	}
+
+	~LuaPopper()
+	{
+		lua_pop(mState, 1);
+	}
+};
+
+
+
+
+
+/** Pushes the exception details onto the Lua state and returns the number of items pushed.
+Used to provide a return value from a function call. Takes any std::exception, so that the standard library failures
+(std::bad_alloc, std::system_error, std::filesystem::filesystem_error) are reported the same way as an Exception.
+The first value pushed is always a nil, to signalize an error to the Lua script. */
+static int pushException(lua_State * aState, const std::exception & aException)
+{
+	lua_pushnil(aState);
+	lua_pushstring(aState, aException.what());
+	return 2;
+}
+
+
+
+
+
+/** Returns the string at the specified Lua stack position.
+Throws a general Exception if there's no string there. */
+static std::string readString(lua_State * aState, int aStackPos)
+{
+	size_t len;
+	auto s = lua_tolstring(aState, aStackPos, &len);
+	if (s == nullptr)
+	{
+		throw Exception(fmt::format("Expected a string at stack position {}.", aStackPos));
+	}
+	return std::string(s, len);
+}
+
+
+
+
+
+/** Reads the URL to be requested from the Lua stack at the specified position into the request.
+Throws an Exception on error. */
+static void readUrl(lua_State * aState, int aStackPos, Request & aRequest)
+{
+	try
+	{
+		aRequest.setUrl(readString(aState, aStackPos));
+	}
+	catch (const Exception & exc)
+	{
+		throw Exception(fmt::format("Expected an URL string in parameter {} ({})", aStackPos, exc.what()));
+	}
+}
+
+
+
+
+
+/** Reads the name = value fields of a form from the table at the specified position of the Lua stack.
+A value may also be an array-table of values, the field is then repeated for each of them.
+The fields are sorted by name, so that the encoded body doesn't depend on the table traversal order. */
+static std::vector<std::pair<std::string, std::string>> readFormFields(lua_State * aState, int aStackPos)
+{
+	std::vector<std::pair<std::string, std::string>> res;
+	lua_pushnil(aState);
+	while (lua_next(aState, aStackPos) != 0)
+	{
+		LuaPopper popV(aState);
+		if (lua_type(aState, -2) != LUA_TSTRING)
+		{
+			throw Exception(fmt::format("Expected string field names in the form table, got a {}.", lua_typename(aState, lua_type(aState, -2))));
+		}
+		auto name = readString(aState, -2);
+		switch (lua_type(aState, -1))
+		{
+			case LUA_TSTRING:
+			case LUA_TNUMBER:
+			{
+				// Convert a copy, so that lua_tolstring() doesn't modify the value in the table:
+				lua_pushvalue(aState, -1);
+				LuaPopper popCopy(aState);
+				res.emplace_back(name, readString(aState, -1));
+				break;
+			}
+			case LUA_TTABLE:
+			{
+				for (int i = 1;; ++i)
+				{
+					lua_rawgeti(aState, -1, i);
+					LuaPopper popItem(aState);
+					if (lua_isnil(aState, -1))
+					{
+						break;
+					}
+					if ((lua_type(aState, -1) != LUA_TSTRING) && (lua_type(aState, -1) != LUA_TNUMBER))
+					{
+						throw Exception(fmt::format("Expected string values for form field \"{}\", got a {}.", name, lua_typename(aState, lua_type(aState, -1))));
+					}
+					res.emplace_back(name, readString(aState, -1));
+				}
+				break;
+			}
+			default:
+			{
+				throw Exception(fmt::format("Expected a string value for form field \"{}\", got a {}.", name, lua_typename(aState, lua_type(aState, -1))));
+			}
+		}
+	}
+	std::stable_sort(res.begin(), res.end(),
+		[](const auto & aField1, const auto & aField2)
+		{
+			return (aField1.first < aField2.first);
+		}
+	);
+	return res;
+}
+
+
+
+
+
+/** Reads the body to be sent from the Lua stack at the specified position into the request.
+A string is sent as-is, a table of name = value fields is encoded as application/x-www-form-urlencoded.
+If the request already has a multipart body (from the params table), the body must be nil.
+Throws an Exception on error. */
+static void readBody(lua_State * aState, int aStackPos, Request & aRequest)
+{
+	if (aRequest.hasMultipartBody())
+	{
+		if (!lua_isnil(aState, aStackPos) && !lua_isnone(aState, aStackPos))
+		{
+			throw Exception(fmt::format("Cannot send both a request body in parameter {} and a multipart body.", aStackPos));
+		}
+		return;
+	}
+	if (lua_istable(aState, aStackPos))
+	{
+		aRequest.setBody(LuaSimpleWinHttp::encodeForm(readFormFields(aState, aStackPos)));
+		return;
+	}
+	try
+	{
+		aRequest.setBody(readString(aState, aStackPos));
+	}
+	catch (const Exception & exc)
+	{
+		throw Exception(fmt::format("Expected a request body string or form table in parameter {} ({})", aStackPos, exc.what()));
+	}
+}
+
+
+
+
+
+/** Reads the content type to be sent from the Lua stack at the specified position into the request.
+If the position is not valid, uses aDefault instead, or keeps the multipart content type if the request has a multipart body.
+Throws an Exception on error, or if a content type is given together with a multipart body (it would lose the boundary). */
+static void readContentType(lua_State * aState, int aStackPos, const std::string & aDefault, Request & aRequest)
+{
+	// If there is no param, use the default:
+	if (lua_isnil(aState, aStackPos) || lua_isnone(aState, aStackPos))
+	{
+		if (!aRequest.hasMultipartBody())
+		{
+			aRequest.setContentType(std::string(aDefault));
+		}
+		return;
+	}
+
+	// Otherwise read the param:
+	if (aRequest.hasMultipartBody())
+	{
+		throw Exception(fmt::format("Cannot send a content type in parameter {} with a multipart body, its content type is set automatically.", aStackPos));
+	}
+	try
+	{
+		aRequest.setContentType(readString(aState, aStackPos));
+	}
+	catch (const Exception & exc)
+	{
+		throw Exception(fmt::format("Expected a request body content type string in parameter {} ({})", aStackPos, exc.what()));
+	}
+}
+
+
+
+
+
+/** Reads the optional headers from the table at the the specified position of the Lua stack into the request.
+The request can be anything with an addHeader() method (Request, Download). */
+template <typename RequestType>
+static void readParamsHeaders(lua_State * aState, int aParamsStackPos, RequestType & aRequest)
+{
+	lua_getfield(aState, aParamsStackPos, "headers");
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return;
+	}
+	if (!lua_istable(aState, -1))
+	{
+		throw Exception(fmt::format("Expected a table for the \"headers\" in additional parameters in parameter {}, got a {}.",
+			aParamsStackPos, lua_typename(aState, lua_type(aState, -1)))
+		);
+	}
+	for (int i = 1;;++i)
+	{
+		lua_pushinteger(aState, i);
+		LuaPopper popV(aState);
+		lua_gettable(aState, -2);
+		auto type = lua_type(aState, -1);
+		switch (type)
+		{
+			case LUA_TNIL:
+			{
+				return;
+			}
+			case LUA_TSTRING:
+			{
+				size_t len = 0;
+				auto str = lua_tolstring(aState, -1, &len);
+				aRequest.addHeader({str, len});
+				break;
+			}
+			default:
+			{
+				throw Exception(fmt::format("Expected a string header in the \"headers\" additional param, got a {} instead.",
+					lua_typename(aState, type))
+				);
+			}
+		}  // switch (type)
+	}  // for i
+}
+
+
+
+
+
+/** Reads the string field of the specified name from the table at the top of the Lua stack.
+Returns an empty string if the field is nil. */
+static std::string readOptionalStringField(lua_State * aState, const char * aFieldName)
+{
+	lua_getfield(aState, -1, aFieldName);
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return {};
+	}
+	if ((lua_type(aState, -1) != LUA_TSTRING) && (lua_type(aState, -1) != LUA_TNUMBER))
+	{
+		throw Exception(fmt::format("Expected a string for \"{}\" in a multipart part, got a {}.", aFieldName, lua_typename(aState, lua_type(aState, -1))));
+	}
+	lua_pushvalue(aState, -1);
+	LuaPopper popCopy(aState);
+	return readString(aState, -1);
+}
+
+
+
+
+
+/** Reads the optional multipart body parts from the table at the specified position of the Lua stack into the request. */
+static void readParamsMultipart(lua_State * aState, int aParamsStackPos, Request & aRequest)
+{
+	lua_getfield(aState, aParamsStackPos, "multipart");
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return;
+	}
+	if (!lua_istable(aState, -1))
+	{
+		throw Exception(fmt::format("Expected a table for the \"multipart\" in additional parameters in parameter {}, got a {}.",
+			aParamsStackPos, lua_typename(aState, lua_type(aState, -1)))
+		);
+	}
+	std::vector<LuaSimpleWinHttp::MultipartBody::Part> parts;
+	for (int i = 1;; ++i)
+	{
+		lua_rawgeti(aState, -1, i);
+		LuaPopper popV(aState);
+		if (lua_isnil(aState, -1))
+		{
+			break;
+		}
+		if (!lua_istable(aState, -1))
+		{
+			throw Exception(fmt::format("Expected a table for multipart part #{}, got a {}.", i, lua_typename(aState, lua_type(aState, -1))));
+		}
+		LuaSimpleWinHttp::MultipartBody::Part part;
+		part.mName = readOptionalStringField(aState, "name");
+		part.mValue = readOptionalStringField(aState, "value");
+		part.mFilePath = readOptionalStringField(aState, "file");
+		part.mFileName = readOptionalStringField(aState, "filename");
+		part.mContentType = readOptionalStringField(aState, "contentType");
+		if (part.mName.empty())
+		{
+			throw Exception(fmt::format("Missing the \"name\" in multipart part #{}.", i));
+		}
+		parts.push_back(std::move(part));
+	}
+	aRequest.setMultipartBody(LuaSimpleWinHttp::MultipartBody(std::move(parts)));
+}
+
+
+
+
+
+/** Reads the optional "decode" value from the table at the specified position of the Lua stack into the options. */
+static void readParamsDecode(lua_State * aState, int aParamsStackPos, LuaOptions & aOptions)
+{
+	lua_getfield(aState, aParamsStackPos, "decode");
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return;
+	}
+	size_t len = 0;
+	auto str = (lua_type(aState, -1) == LUA_TSTRING) ? lua_tolstring(aState, -1, &len) : nullptr;
+	if ((str == nullptr) || (std::string(str, len) != "json"))
+	{
+		throw Exception(fmt::format("Unsupported \"decode\" value in additional parameters in parameter {}, only \"json\" is supported.",
+			aParamsStackPos)
+		);
+	}
+	aOptions.mDecodeJson = true;
+}
+
+
+
+
+
+/** Reads the optional "bodyType" value from the table at the specified position of the Lua stack.
+For the "buffer" body type, sets up the request to receive the body into a ByteBuffer stored in the options. */
+static void readParamsBodyType(lua_State * aState, int aParamsStackPos, Request & aRequest, LuaOptions & aOptions)
+{
+	lua_getfield(aState, aParamsStackPos, "bodyType");
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return;
+	}
+	size_t len = 0;
+	auto str = (lua_type(aState, -1) == LUA_TSTRING) ? lua_tolstring(aState, -1, &len) : nullptr;
+	std::string bodyType = (str == nullptr) ? std::string() : std::string(str, len);
+	if (bodyType == "string")
+	{
+		return;
+	}
+	if (bodyType != "buffer")
+	{
+		throw Exception(fmt::format("Unsupported \"bodyType\" value in additional parameters in parameter {}, expected \"string\" or \"buffer\".",
+			aParamsStackPos)
+		);
+	}
+	if (aOptions.mDecodeJson)
+	{
+		throw Exception("The \"buffer\" body type cannot be combined with JSON decoding.");
+	}
+	auto buffer = std::make_shared<LuaSimpleWinHttp::ByteBuffer>();
+	aRequest.setBodySink([buffer](const char * aData, size_t aSize)
+		{
+			buffer->append(aData, aSize);
+		}
+	);
+	aOptions.mBodyBuffer = std::move(buffer);
+}
+
+
+
+
+
+/** Reads the optional "coalesce" boolean from the table at the specified position of the Lua stack into the request. */
+static void readParamsCoalesce(lua_State * aState, int aParamsStackPos, Request & aRequest)
+{
+	lua_getfield(aState, aParamsStackPos, "coalesce");
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return;
+	}
+	if (!lua_isboolean(aState, -1))
+	{
+		throw Exception(fmt::format("Expected a boolean for the \"coalesce\" in additional parameters in parameter {}.", aParamsStackPos));
+	}
+	aRequest.setCoalesce(lua_toboolean(aState, -1) != 0);
+}
+
+
+
+
+
+/** Returns true if there is a parameter table at the specified position of the Lua stack, false if there's nil / none.
+Throws an Exception if there's a non-table value. */
+static bool hasParamsTable(lua_State * aState, int aStackPos)
+{
+	switch (lua_type(aState, aStackPos))
+	{
+		case LUA_TNIL:
+		case LUA_TNONE:
+		{
+			return false;
+		}
+		case LUA_TTABLE:
+		{
+			return true;
+		}
+		default:
+		{
+			throw Exception(fmt::format("Expected a table of additional parameters in parameter {}, got a {}.",
+				aStackPos, lua_typename(aState, lua_type(aState, aStackPos)))
+			);
+		}
+	}
+}
+
+
+
+
+
+/** Reads the optional non-negative integer field of the specified name from the table at the specified position
+of the Lua stack. Returns aDefault if the field is nil; values above the range of unsigned are clamped to its maximum.
+Throws an Exception on a non-number, negative or NaN value. */
+static unsigned readParamsUnsigned(lua_State * aState, int aParamsStackPos, const char * aFieldName, unsigned aDefault)
+{
+	lua_getfield(aState, aParamsStackPos, aFieldName);
+	LuaPopper pop(aState);
+	if (lua_isnil(aState, -1))
+	{
+		return aDefault;
+	}
+	auto value = lua_tonumber(aState, -1);
+	if ((lua_type(aState, -1) != LUA_TNUMBER) || !(value >= 0))  // Written so that NaN fails, too
+	{
+		throw Exception(fmt::format("Expected a non-negative number for the \"{}\" in additional parameters in parameter {}.",
+			aFieldName, aParamsStackPos)
+		);
+	}
+
+	// Converting a double outside the unsigned range is undefined behavior, clamp first:
+	constexpr auto maxValue = std::numeric_limits<unsigned>::max();
+	if (value >= static_cast<lua_Number>(maxValue))
+	{
+		return maxValue;
+	}
+	return static_cast<unsigned>(value);
+}
+
+
+
+
+
+/** Reads the parameter table further configuring the request, such as additional headers to add,
+from the Lua stack at the specified position into the request and the binding options.
+Throws an Exception on error (there's a non-table value). */
+static void readParamsTable(lua_State * aState, int aStackPos, Request & aRequest, LuaOptions & aOptions)
+{
+	if (!hasParamsTable(aState, aStackPos))
+	{
+		return;
+	}
+	readParamsHeaders(aState, aStackPos, aRequest);
+	readParamsMultipart(aState, aStackPos, aRequest);
+	readParamsDecode(aState, aStackPos, aOptions);
+	readParamsBodyType(aState, aStackPos, aRequest, aOptions);
+	readParamsCoalesce(aState, aStackPos, aRequest);
+}
+
+
+
+
+
+/** Pushes the response's status code, status text and an array-table of the headers onto the Lua stack. */
+static void pushStatusAndHeaders(lua_State * aState, const Response & aResponse)
+{
+	lua_pushnumber(aState, aResponse.mStatusCode);
+	lua_pushlstring(aState, aResponse.mStatusText.data(), aResponse.mStatusText.size());
+	lua_createtable(aState, static_cast<int>(aResponse.mHeaders.size()), 0);
+	int idx = 0;
+	for (const auto & hdr: aResponse.mHeaders)
+	{
+		lua_pushlstring(aState, hdr.data(), hdr.size());
+		lua_rawseti(aState, -2, ++idx);
+	}
+}
+
+
+
+
+
+/** Pushes the response onto the Lua stack: the body, the status code, the status text and an array-table of the headers.
+If the options ask for JSON decoding, the decoded body is pushed instead of the body string (nil for an empty body);
+if they ask for a byte buffer, the buffer userdata is pushed instead.
+Returns the number of values pushed onto the Lua stack. */
+static int pushResponse(lua_State * aState, const Response & aResponse, const LuaOptions & aOptions)
+{
+	if (aOptions.mBodyBuffer != nullptr)
+	{
+		aOptions.mBodyBuffer->finish();
+		LuaSimpleWinHttp::pushByteBuffer(aState, aOptions.mBodyBuffer);
+	}
+	else if (!aOptions.mDecodeJson)
+	{
+		lua_pushlstring(aState, aResponse.mBody.data(), aResponse.mBody.size());
+	}
+	else if (aResponse.mBody.empty())
+	{
+		lua_pushnil(aState);
+	}
+	else
+	{
+		LuaSimpleWinHttp::pushJson(aState, aResponse.mBody.data(), aResponse.mBody.size());
+	}
+	pushStatusAndHeaders(aState, aResponse);
+	return 4;
+}
+
+
+
+
+
 static int lswh_delete(lua_State * aState)
 {
-	LuaSimpleWinHttp::Request req(aState, "DELETE");
 	try
 	{
-		req.readUrl(1);
-		req.readParamsTable(2);
-		return req.make();
+		LuaOptions options;
+		Request req(Client::defaultClient(), "DELETE");
+		readUrl(aState, 1, req);
+		readParamsTable(aState, 2, req, options);
+		return pushResponse(aState, req.make(), options);
+	}
+	catch (const std::exception & exc)
+	{
+		return pushException(aState, exc);
+	}
+}
+
+
+
+
+
+static int lswh_download(lua_State * aState)
+{
+	try
+	{
+		LuaSimpleWinHttp::Download download(Client::defaultClient(), readString(aState, 1), readString(aState, 2));
+		if (hasParamsTable(aState, 3))
+		{
+			readParamsHeaders(aState, 3, download);
+			download.setNumSegments(readParamsUnsigned(aState, 3, "segments", 1));
+			download.setNumRetries(readParamsUnsigned(aState, 3, "retries", 2));
+		}
+		auto resp = download.make();
+		lua_pushnumber(aState, static_cast<lua_Number>(download.bytesWritten()));
+		pushStatusAndHeaders(aState, resp);
+		return 4;
 	}
-	catch (const LuaSimpleWinHttp::Exception & exc)
+	catch (const std::exception & exc)
 	{
-		return exc.pushTo(aState);
+		return pushException(aState, exc);
 	}
 }
 
@@ -33,16 +628,38 @@ static int lswh_delete(lua_State * aState)
 
 static int lswh_get(lua_State * aState)
 {
-	LuaSimpleWinHttp::Request req(aState, "GET");
 	try
 	{
-		req.readUrl(1);
-		req.readParamsTable(2);
-		return req.make();
+		LuaOptions options;
+		Request req(Client::defaultClient(), "GET");
+		readUrl(aState, 1, req);
+		readParamsTable(aState, 2, req, options);
+		return pushResponse(aState, req.make(), options);
+	}
+	catch (const std::exception & exc)
+	{
+		return pushException(aState, exc);
+	}
+}
+
+
+
+
+
+static int lswh_get_json(lua_State * aState)
+{
+	try
+	{
+		LuaOptions options;
+		options.mDecodeJson = true;
+		Request req(Client::defaultClient(), "GET");
+		readUrl(aState, 1, req);
+		readParamsTable(aState, 2, req, options);
+		return pushResponse(aState, req.make(), options);
 	}
-	catch (const LuaSimpleWinHttp::Exception & exc)
+	catch (const std::exception & exc)
 	{
-		return exc.pushTo(aState);
+		return pushException(aState, exc);
 	}
 }
 
@@ -52,16 +669,17 @@ static int lswh_get(lua_State * aState)
 
 static int lswh_head(lua_State * aState)
 {
-	LuaSimpleWinHttp::Request req(aState, "HEAD");
 	try
 	{
-		req.readUrl(1);
-		req.readParamsTable(2);
-		return req.make();
+		LuaOptions options;
+		Request req(Client::defaultClient(), "HEAD");
+		readUrl(aState, 1, req);
+		readParamsTable(aState, 2, req, options);
+		return pushResponse(aState, req.make(), options);
 	}
-	catch (const LuaSimpleWinHttp::Exception & exc)
+	catch (const std::exception & exc)
 	{
-		return exc.pushTo(aState);
+		return pushException(aState, exc);
 	}
 }
 
@@ -71,18 +689,19 @@ static int lswh_head(lua_State * aState)
 
 static int lswh_post(lua_State * aState)
 {
-	LuaSimpleWinHttp::Request req(aState, "POST");
 	try
 	{
-		req.readUrl(1);
-		req.readBody(2);
-		req.readContentType(3, "application/x-www-form-urlencoded");
-		req.readParamsTable(4);
-		return req.make();
+		LuaOptions options;
+		Request req(Client::defaultClient(), "POST");
+		readUrl(aState, 1, req);
+		readParamsTable(aState, 4, req, options);  // Before the body, it may specify a multipart body
+		readBody(aState, 2, req);
+		readContentType(aState, 3, "application/x-www-form-urlencoded", req);
+		return pushResponse(aState, req.make(), options);
 	}
-	catch (const LuaSimpleWinHttp::Exception & exc)
+	catch (const std::exception & exc)
 	{
-		return exc.pushTo(aState);
+		return pushException(aState, exc);
 	}
 }
 
@@ -92,18 +711,130 @@ static int lswh_post(lua_State * aState)
 
 static int lswh_put(lua_State * aState)
 {
-	LuaSimpleWinHttp::Request req(aState, "PUT");
 	try
 	{
-		req.readUrl(1);
-		req.readBody(2);
-		req.readContentType(3, "application/x-www-form-urlencoded");
-		req.readParamsTable(4);
-		return req.make();
+		LuaOptions options;
+		Request req(Client::defaultClient(), "PUT");
+		readUrl(aState, 1, req);
+		readParamsTable(aState, 4, req, options);  // Before the body, it may specify a multipart body
+		readBody(aState, 2, req);
+		readContentType(aState, 3, "application/x-www-form-urlencoded", req);
+		return pushResponse(aState, req.make(), options);
 	}
-	catch (const LuaSimpleWinHttp::Exception & exc)
+	catch (const std::exception & exc)
 	{
-		return exc.pushTo(aState);
+		return pushException(aState, exc);
+	}
+}
+
+
+
+
+
+static int lswh_live(lua_State * aState)
+{
+	Client::defaultClient().setRecorder(nullptr);
+	Client::defaultClient().setReplayer(nullptr);
+	lua_pushboolean(aState, 1);
+	return 1;
+}
+
+
+
+
+
+/** lswh.preconnect(url or {url, ...}, {count = n}): starts warming up n connections (default 1) to the server
+of each URL in the background. Returns true immediately, or nil and the message if an URL is malformed. */
+static int lswh_preconnect(lua_State * aState)
+{
+	try
+	{
+		unsigned count = 1;
+		if (hasParamsTable(aState, 2))
+		{
+			count = readParamsUnsigned(aState, 2, "count", 1);
+		}
+		std::vector<std::string> urls;
+		if (lua_istable(aState, 1))
+		{
+			for (int i = 1;; ++i)
+			{
+				lua_rawgeti(aState, 1, i);
+				LuaPopper pop(aState);
+				if (lua_isnil(aState, -1))
+				{
+					break;
+				}
+				if (lua_type(aState, -1) != LUA_TSTRING)
+				{
+					throw Exception(fmt::format("Expected an URL string for item #{} in parameter 1, got a {}.",
+						i, lua_typename(aState, lua_type(aState, -1)))
+					);
+				}
+				urls.push_back(lua_tostring(aState, -1));
+			}
+		}
+		else
+		{
+			urls.push_back(readString(aState, 1));
+		}
+		for (const auto & url: urls)
+		{
+			Client::defaultClient().preconnect(url, count);
+		}
+		lua_pushboolean(aState, 1);
+		return 1;
+	}
+	catch (const std::exception & exc)
+	{
+		return pushException(aState, exc);
+	}
+}
+
+
+
+
+
+static int lswh_record(lua_State * aState)
+{
+	try
+	{
+		auto recorder = std::make_shared<LuaSimpleWinHttp::TrafficRecorder>(readString(aState, 1));
+		Client::defaultClient().setReplayer(nullptr);
+		Client::defaultClient().setRecorder(std::move(recorder));
+		lua_pushboolean(aState, 1);
+		return 1;
+	}
+	catch (const std::exception & exc)
+	{
+		return pushException(aState, exc);
+	}
+}
+
+
+
+
+
+static int lswh_replay(lua_State * aState)
+{
+	try
+	{
+		bool shouldReproduceLatency = false;
+		if (hasParamsTable(aState, 2))
+		{
+			lua_getfield(aState, 2, "latency");
+			shouldReproduceLatency = lua_toboolean(aState, -1);
+			lua_pop(aState, 1);
+		}
+		auto replayer = std::make_shared<LuaSimpleWinHttp::TrafficReplayer>(readString(aState, 1), shouldReproduceLatency);
+		Client::defaultClient().setRecorder(nullptr);
+		Client::defaultClient().setReplayer(std::move(replayer));
+		lua_pushboolean(aState, 1);
+		return 1;
+	}
+	catch (const std::exception & exc)
+	{
+		return pushException(aState, exc);
 	}
 }
 
@@ -124,18 +855,19 @@ static int lswh_request(lua_State * aState)
 	}
 
 
-	LuaSimpleWinHttp::Request req(aState, {s, len});
 	try
 	{
-		req.readUrl(2);
-		req.readBody(3);
-		req.readContentType(4, "application/x-www-form-urlencoded");
-		req.readParamsTable(5);
-		return req.make();
+		LuaOptions options;
+		Request req(Client::defaultClient(), {s, len});
+		readUrl(aState, 2, req);
+		readParamsTable(aState, 5, req, options);  // Before the body, it may specify a multipart body
+		readBody(aState, 3, req);
+		readContentType(aState, 4, "application/x-www-form-urlencoded", req);
+		return pushResponse(aState, req.make(), options);
 	}
-	catch (const LuaSimpleWinHttp::Exception & exc)
+	catch (const std::exception & exc)
 	{
-		return exc.pushTo(aState);
+		return pushException(aState, exc);
 	}
 }
 
@@ -143,14 +875,110 @@ static int lswh_request(lua_State * aState)
 
 
 
+static int lswh_tls_stats(lua_State * aState)
+{
+	auto stats = Client::defaultClient().tlsStats();
+	lua_createtable(aState, 0, 3);
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumFullHandshakes));
+	lua_setfield(aState, -2, "full");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumResumedHandshakes));
+	lua_setfield(aState, -2, "resumed");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumReusedConnections));
+	lua_setfield(aState, -2, "reused");
+	return 1;
+}
+
+
+
+
+
+/** lswh.coalescing.enable(bool): sets whether all eligible requests are coalesced, not only those asking for it. */
+static int lswh_coalescing_enable(lua_State * aState)
+{
+	luaL_checktype(aState, 1, LUA_TBOOLEAN);
+	Client::defaultClient().setCoalescingEnabled(lua_toboolean(aState, 1) != 0);
+	return 0;
+}
+
+
+
+
+
+static int lswh_coalescing_stats(lua_State * aState)
+{
+	auto stats = Client::defaultClient().coalescingStats();
+	lua_createtable(aState, 0, 2);
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumLeaders));
+	lua_setfield(aState, -2, "leaders");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumCoalesced));
+	lua_setfield(aState, -2, "coalesced");
+	return 1;
+}
+
+
+
+
+
+/** lswh.dns.enable(bool): sets whether the requests use the DNS cache. */
+static int lswh_dns_enable(lua_State * aState)
+{
+	luaL_checktype(aState, 1, LUA_TBOOLEAN);
+	Client::defaultClient().dnsCache().setEnabled(lua_toboolean(aState, 1) != 0);
+	return 0;
+}
+
+
+
+
+
+static int lswh_dns_flush(lua_State * aState)
+{
+	(void)aState;
+	Client::defaultClient().dnsCache().flush();
+	return 0;
+}
+
+
+
+
+
+static int lswh_dns_stats(lua_State * aState)
+{
+	auto stats = Client::defaultClient().dnsCache().stats();
+	lua_createtable(aState, 0, 6);
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumHits));
+	lua_setfield(aState, -2, "hits");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumMisses));
+	lua_setfield(aState, -2, "misses");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumRefreshes));
+	lua_setfield(aState, -2, "refreshes");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumQueries));
+	lua_setfield(aState, -2, "queries");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumFailures));
+	lua_setfield(aState, -2, "failures");
+	lua_pushnumber(aState, static_cast<lua_Number>(stats.mNumEntries));
+	lua_setfield(aState, -2, "entries");
+	return 1;
+}
+
+
+
+
+
 static const struct luaL_Reg lswhlib[] =
 {
-	{"delete",  &lswh_delete},
-	{"get",     &lswh_get},
-	{"head",    &lswh_head},
-	{"post",    &lswh_post},
-	{"put",     &lswh_put},
-	{"request", &lswh_request},
+	{"delete",     &lswh_delete},
+	{"download",   &lswh_download},
+	{"get",        &lswh_get},
+	{"get_json",   &lswh_get_json},
+	{"head",       &lswh_head},
+	{"live",       &lswh_live},
+	{"post",       &lswh_post},
+	{"preconnect", &lswh_preconnect},
+	{"put",        &lswh_put},
+	{"record",     &lswh_record},
+	{"replay",     &lswh_replay},
+	{"request",    &lswh_request},
 	{nullptr, nullptr},
 };
 
@@ -160,6 +988,46 @@ static const struct luaL_Reg lswhlib[] =
 
 LUALIB_API int luaopen_LuaSimpleWinHttp(lua_State * aState)
 {
+	// The DNS refreshes run on detached threads, which may still be inside the library when lua_close() unloads it,
+	// and the default Client would join its warm-ups while unloading, under the loader lock. Keep the library loaded
+	// until the process exits instead (a no-op when linked statically):
+	HMODULE module;
+	GetModuleHandleExW(
+		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+		reinterpret_cast<LPCWSTR>(&luaopen_LuaSimpleWinHttp),
+		&module
+	);
+
 	luaL_openlib(aState, "LuaSimpleWinHttp", lswhlib, 0);
+
+	LuaSimpleWinHttp::registerByteBuffer(aState);
+
+	// The sentinel used for JSON nulls in decoded responses:
+	lua_pushlightuserdata(aState, nullptr);
+	lua_setfield(aState, -2, "null");
+
+	// The "tls" subtable:
+	lua_newtable(aState);
+	lua_pushcfunction(aState, &lswh_tls_stats);
+	lua_setfield(aState, -2, "stats");
+	lua_setfield(aState, -2, "tls");
+
+	// The "coalescing" subtable:
+	lua_newtable(aState);
+	lua_pushcfunction(aState, &lswh_coalescing_enable);
+	lua_setfield(aState, -2, "enable");
+	lua_pushcfunction(aState, &lswh_coalescing_stats);
+	lua_setfield(aState, -2, "stats");
+	lua_setfield(aState, -2, "coalescing");
+
+	// The "dns" subtable:
+	lua_newtable(aState);
+	lua_pushcfunction(aState, &lswh_dns_enable);
+	lua_setfield(aState, -2, "enable");
+	lua_pushcfunction(aState, &lswh_dns_flush);
+	lua_setfield(aState, -2, "flush");
+	lua_pushcfunction(aState, &lswh_dns_stats);
+	lua_setfield(aState, -2, "stats");
+	lua_setfield(aState, -2, "dns");
 	return 1;
 }
@@ -1,19 +1,18 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 
-#define NOMINMAX
-#include <Windows.h>
-#include <winhttp.h>
-
-
-
-
-
-// fwd: lua.h
-struct lua_State;
+#include "BodyEncoders.h"
+#include "Client.h"
 
 
 
@@ -26,8 +25,7 @@ namespace LuaSimpleWinHttp
 
 
 
-/** Exception that is thrown on LSWH errors.
-Supports pushing its information to a Lua state for ease of use. */
+/** Exception that is thrown on LSWH errors. */
 class Exception:
 	public std::runtime_error
 {
@@ -37,11 +35,32 @@ class Exception:
 public:
 
 	Exception(std::string && aDescription);
+};
+
+
+
+
+
+/** The response received from the server for a single Request. */
+struct Response
+{
+	/** The response body. */
+	std::string mBody;
 
-	/** Pushes the exception details onto the Lua state and returns the number of items pushed.
-	Used to provide a return value from a function call.
-	The first value pushed is always a nil, to signalize an error to the Lua script. */
-	int pushTo(lua_State * aState) const;
+	/** The HTTP status code (200, 404 etc.). */
+	unsigned mStatusCode = 0;
+
+	/** The HTTP status text ("OK", "Not Found" etc.). */
+	std::string mStatusText;
+
+	/** All the response headers, each item is a single header in the "Name: Value" form.
+	The status line is not included. */
+	std::vector<std::string> mHeaders;
+
+
+	/** Returns the value of the first header of the specified name (case-insensitive),
+	or an empty string if there's no such header. */
+	std::string header(std::string_view aName) const;
 };
 
 
@@ -51,14 +70,54 @@ public:
 /** Represents a single HTTP request being made.
 Usage:
 - Create an instance
-- Read the parameters from Lua VM to the instance (readX() methods)
+- Set the request parameters (setX() and addX() methods)
 - Call make() to actually send the request and receive the response
 - Delete the instance
-One instance can only make one request. The make() function cannot be called multiple times. */
+One instance can only make one request. The make() function cannot be called multiple times.
+This class has no dependency on Lua, it can be used directly from C++ code. */
 class Request
 {
-	/** The Lua VM that is tied to this request. */
-	lua_State * mState;
+public:
+
+	/** The size of the initial storage of the per-request arena.
+	Most of the transient data is ucs2 text, so the size is given in wchar_t units (4 KiB on Windows). */
+	static constexpr size_t ARENA_BUFFER_SIZE = 2048 * sizeof(wchar_t);
+
+	/** The request data converted into the form that WinHttp takes, see prepareLive(). */
+	struct LiveParams
+	{
+		bool mIsSecure;
+		std::pmr::wstring mServerName;
+		std::uint16_t mPort;
+		std::pmr::wstring mPath;
+		std::pmr::wstring mHttpVerb;
+
+		/** The "Content-Type: ..." header, or empty if the request has no body. */
+		std::pmr::wstring mContentTypeHeader;
+
+		/** The additional headers separated by CRLF, with a synthetic Accept header appended if there is none. */
+		std::pmr::wstring mHeaders;
+	};
+
+
+private:
+
+	/** The client through which the request is made. */
+	Client & mClient;
+
+	/** The initial storage for mArena.
+	Sized so that a typical small request doesn't need any further heap allocations for its transient data
+	(checked by the TestArena self-test in Request.cpp). */
+	alignas(std::max_align_t) std::byte mArenaBuffer[ARENA_BUFFER_SIZE];
+
+	/** The per-request arena from which all the transient strings and vectors (URL parts, ucs2 conversions,
+	headers) are allocated. Everything is released at once when the request is destroyed.
+	The request parameters (verb, URL, body, content type, body sink) and the returned Response still use the
+	global heap, since they are handed over from, or to, the caller. A typical live GET thus allocates from the
+	global heap only the URL string (unless it fits the small string buffer), the Response::mHeaders vector and one
+	string per response header that doesn't fit the small string buffer, and the growing response body; plus a single
+	key string when coalescing, and whatever WinHttp allocates internally. */
+	std::pmr::monotonic_buffer_resource mArena;
 
 	/** The HTTP verb ("GET", "POST" etc.) for the request. */
 	std::string mHttpVerb;
@@ -73,6 +132,15 @@ class Request
 	/** The content type of the body to send. */
 	std::string mContentType;
 
+	/** The multipart body to stream to the server instead of mBody, if any. */
+	std::unique_ptr<MultipartBody> mMultipartBody;
+
+	/** If true, the request may be coalesced with identical in-flight requests (see Client::coalesce()). */
+	bool mShouldCoalesce;
+
+	/** If set, the response body is passed to this function as it is received, instead of being stored in the Response. */
+	std::function<void(const char * aData, size_t aSize)> mBodySink;
+
 	/** The HTTP connection used for this request, as returned by WinHttpConnect(). */
 	HINTERNET mConnection;
 
@@ -81,55 +149,116 @@ class Request
 
 	/** The additional headers to add to the request.
 	Each item is a single header in the "Name: Value" form. */
-	std::vector<std::string> mAdditionalHeaders;
-
+	std::pmr::vector<std::pmr::string> mAdditionalHeaders;
 
-	/** Returns the string at the specified Lua stack position.
-	Throws a general Exception if there's no string there. */
-	std::string readString(int aStackPos);
 
-	/** Returns true if there is an "Accept:" header in mAdditionalHeaders.
+	/** Returns true if there is an "Accept:" header in aHeaders.
 	Used to detect whether a synthetic Accept header should be appended to the request. */
-	bool hasAcceptHeader() const;
+	static bool hasAcceptHeader(const std::pmr::vector<std::pmr::string> & aHeaders);
 
-	/** Parses the returned headers and pushes them onto the Lua stack as an array-table of "Name: Value" strings.
+	/** Parses the returned headers into an array of "Name: Value" strings.
 	The first "header" is the status code and text, those are skipped. */
-	void pushHeaders(const std::string & aAllHeaders);
+	static std::vector<std::string> parseHeaders(std::string_view aAllHeaders);
 
+	/** Returns the value of the first additional header of the specified name (case-insensitive),
+	or an empty view if there's no such header. */
+	std::string_view additionalHeaderValue(std::string_view aName) const;
 
-public:
+	/** Sends the request with mMultipartBody streamed as its body.
+	Throws an Exception on error. */
+	void sendMultipartBody();
 
-	/** Creates a new Request object tied to the specified state that will use the specified HTTP verb. */
-	Request(lua_State * aState, std::string && aHttpVerb);
+	/** Returns true if the request can be coalesced with identical in-flight requests:
+	it is a GET or HEAD with no body and its response body is not consumed by a sink. */
+	bool isCoalescable() const;
 
-	~Request();
+	/** Returns the key identifying identical coalescable requests: the verb, URL and the additional headers. */
+	std::string coalescingKey() const;
 
-	/** Reads the URL to be requested from the Lua stack at the specified position.
+	/** Makes the request without coalescing: from the traffic log when replaying, otherwise over the network.
 	Throws an Exception on error. */
-	void readUrl(int aStackPos);
+	Response makeUncoalesced();
 
-	/** Reads the body to be sent from the Lua stack at the specified position.
+	/** Makes the request over the network.
 	Throws an Exception on error. */
-	void readBody(int aStackPos);
+	Response makeLive();
 
-	/** Reads the content type to be sent from the Lua stack at the specified position.
-	If the position is not valid, uses aDefault instead.
+	/** Makes the request over the network and records the exchange into the specified recorder.
 	Throws an Exception on error. */
-	void readContentType(int aStackPos, const std::string & aDefault);
+	Response makeRecorded(TrafficRecorder & aRecorder);
+
+	/** Serves the request from the specified replayer, without any network I/O.
+	Throws an Exception if there's no matching recorded exchange. */
+	Response makeReplayed(TrafficReplayer & aReplayer);
+
+
+public:
+
+	/** Creates a new Request object that will use the specified HTTP verb and be made through the specified client. */
+	Request(Client & aClient, std::string && aHttpVerb);
+
+	~Request();
+
+	Request(const Request &) = delete;
+	Request & operator = (const Request &) = delete;
+
+	/** Sets the URL to be requested. */
+	void setUrl(std::string && aUrl) { mUrl = std::move(aUrl); }
 
-	/** Reads the parameter table further configuring the request, such as additional headers to add,
-	from the Lua stack at the specified position.
-	Throws an Exception on error (there's a non-table value). */
-	void readParamsTable(int aStackPos);
+	/** Sets the body to be sent. */
+	void setBody(std::string && aBody) { mBody = std::move(aBody); }
 
-	/** Reads the optional headers from the table at the the specified position of the Lua stack. */
-	void readParamsHeaders(int aParamsStackPos);
+	/** Sets the multipart body to be streamed to the server instead of the plain body.
+	Also sets the content type to multipart/form-data with the body's boundary. */
+	void setMultipartBody(MultipartBody && aBody);
+
+	/** Returns true if a multipart body has been set for the request. */
+	bool hasMultipartBody() const { return (mMultipartBody != nullptr); }
+
+	/** Sets the function that receives the response body in chunks as it is being received.
+	The Response returned from make() will then have an empty body.
+	The sink may throw an Exception to abort the request. */
+	void setBodySink(std::function<void(const char * aData, size_t aSize)> && aSink) { mBodySink = std::move(aSink); }
+
+	/** Sets whether the request may share the response of an identical in-flight request, instead of being sent.
+	Only GET and HEAD requests without a body sink are ever coalesced. */
+	void setCoalesce(bool aShouldCoalesce) { mShouldCoalesce = aShouldCoalesce; }
+
+	/** Sets the content type of the body to be sent. */
+	void setContentType(std::string && aContentType) { mContentType = std::move(aContentType); }
+
+	/** Adds an additional header to the request, in the "Name: Value" form. */
+	void addHeader(std::string_view aHeader) { mAdditionalHeaders.emplace_back(aHeader); }
 
 	/** Makes the request.
-	Connects to the server, sends the request, receives the response and pushes it onto mState's stack.
-	Throws an Exception on error.
-	Returns the number of values pushed onto the Lua stack. */
-	int make();
+	Connects to the server, sends the request, receives the response and returns it.
+	If the client is replaying a traffic log, the response is served from the log instead; if it is recording,
+	the exchange is appended to the log. If coalescing is enabled (for the request or the whole client) and an
+	identical request is already in flight, waits for it and returns a copy of its response instead.
+	Throws an Exception on error. */
+	Response make();
+
+	/** Converts the request data into the form that WinHttp takes, for makeLive(): parses the URL and converts the verb
+	and the headers to ucs2. aContentType is only used if aHasBody is true. Everything is allocated from aArena.
+	Throws an Exception if the URL is malformed. */
+	static LiveParams prepareLive(
+		std::string_view aHttpVerb,
+		std::string_view aUrl,
+		const std::pmr::vector<std::pmr::string> & aAdditionalHeaders,
+		bool aHasBody,
+		std::string_view aContentType,
+		std::pmr::memory_resource * aArena
+	);
+
+	/** Converts the raw response headers, as returned by WinHttp (CRLF-separated ucs2), to utf8 in aArena and parses
+	them, see parseHeaders(). Only the returned vector and its strings are allocated from the global heap. */
+	static std::vector<std::string> parseRawHeaders(const std::pmr::vector<wchar_t> & aRawHeaders, std::pmr::memory_resource * aArena);
+
+	/** Parses the URL into the server name, port and path parts, converting them from utf8 to ucs2 in the process.
+	The returned strings are allocated from the specified memory resource.
+	Throws an Exception if the URL is malformed or not recognized. */
+	static std::tuple<bool /* IsSecure*/, std::pmr::wstring /* ServerName */ , std::uint16_t /* ServerPort */, std::pmr::wstring /* UrlPath */>
+	parseUrl(std::string_view aUrl, std::pmr::memory_resource * aResource);
 };
 
 }
@@ -0,0 +1,383 @@
+#include "TrafficLog.h"
+
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include "Request.h"
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/** The signature at the start of each traffic log file. */
+static const char LOG_SIGNATURE[] = "LSWHLOG1";
+static const size_t LOG_SIGNATURE_SIZE = sizeof(LOG_SIGNATURE) - 1;
+
+
+
+
+
+/** Appends the integer to the buffer, as little-endian. */
+template <typename IntType>
+static void appendInt(std::string & aDest, IntType aValue)
+{
+	for (size_t i = 0; i < sizeof(aValue); ++i)
+	{
+		aDest.push_back(static_cast<char>((aValue >> (8 * i)) & 0xff));
+	}
+}
+
+
+
+
+
+/** Appends the length-prefixed field to the buffer. */
+static void appendField(std::string & aDest, std::string_view aField)
+{
+	appendInt<std::uint64_t>(aDest, aField.size());
+	aDest.append(aField);
+}
+
+
+
+
+
+/** Sequential reader of the little-endian fields in the mapped log. */
+class LogReader
+{
+	const char * mCur;
+	const char * mEnd;
+
+
+public:
+
+	LogReader(const char * aStart, const char * aEnd):
+		mCur(aStart),
+		mEnd(aEnd)
+	{
+	}
+
+	const char * pos() const { return mCur; }
+
+	/** Reads an integer. Returns false if there isn't enough data left. */
+	template <typename IntType>
+	bool readInt(IntType & aValue)
+	{
+		if (static_cast<size_t>(mEnd - mCur) < sizeof(aValue))
+		{
+			return false;
+		}
+		aValue = 0;
+		for (size_t i = 0; i < sizeof(aValue); ++i)
+		{
+			aValue |= static_cast<IntType>(static_cast<unsigned char>(mCur[i])) << (8 * i);
+		}
+		mCur += sizeof(aValue);
+		return true;
+	}
+
+	/** Reads a length-prefixed field as a view into the mapped data. Returns false if there isn't enough data left. */
+	bool readField(std::string_view & aField)
+	{
+		std::uint64_t size;
+		if (!readInt(size) || (static_cast<std::uint64_t>(mEnd - mCur) < size))
+		{
+			return false;
+		}
+		aField = std::string_view(mCur, static_cast<size_t>(size));
+		mCur += size;
+		return true;
+	}
+};
+
+
+
+
+
+/** Returns the size of the valid part of an existing traffic log: the signature followed by all the complete records.
+Returns 0 if the file is empty or only holds a part of the signature (torn when it was created), and std::nullopt
+if the file doesn't exist.
+Throws an Exception if the existing file cannot be read, or is not a traffic log; the caller truncates the file
+to the returned size, so any doubt must throw rather than return a smaller size. */
+static std::optional<std::uint64_t> validLogSize(const std::filesystem::path & aPath, const std::string & aFileName)
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(aPath, ec))
+	{
+		if (ec)
+		{
+			throw Exception(fmt::format("Failed to access traffic log \"{}\": {}", aFileName, ec.message()));
+		}
+		return std::nullopt;
+	}
+	std::ifstream file(aPath, std::ios::binary);
+	file.seekg(0, std::ios::end);
+	auto end = file.tellg();
+	if (!file.is_open() || (end < 0))
+	{
+		throw Exception(fmt::format("Failed to read the existing traffic log \"{}\", refusing to append to it.", aFileName));
+	}
+	auto fileSize = static_cast<std::uint64_t>(end);
+	file.seekg(0);
+	char signature[LOG_SIGNATURE_SIZE];
+	file.read(signature, LOG_SIGNATURE_SIZE);
+	auto signatureSize = static_cast<size_t>(file.gcount());
+	if (std::memcmp(signature, LOG_SIGNATURE, signatureSize) != 0)
+	{
+		throw Exception(fmt::format("The file \"{}\" is not a traffic log, refusing to append to it.", aFileName));
+	}
+	if (signatureSize < LOG_SIGNATURE_SIZE)
+	{
+		return 0;
+	}
+
+	// Skip over the records, until one doesn't fit into the file:
+	std::uint64_t pos = LOG_SIGNATURE_SIZE;
+	while (fileSize - pos >= sizeof(std::uint64_t))
+	{
+		char sizeBytes[sizeof(std::uint64_t)];
+		file.seekg(static_cast<std::streamoff>(pos));
+		if (!file.read(sizeBytes, sizeof(sizeBytes)))
+		{
+			throw Exception(fmt::format("Failed to read the existing traffic log \"{}\", refusing to append to it.", aFileName));
+		}
+		std::uint64_t payloadSize;
+		LogReader reader(sizeBytes, sizeBytes + sizeof(sizeBytes));
+		reader.readInt(payloadSize);
+		if (fileSize - pos - sizeof(std::uint64_t) < payloadSize)
+		{
+			break;
+		}
+		pos += sizeof(std::uint64_t) + payloadSize;
+	}
+	return pos;
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TrafficRecorder:
+
+TrafficRecorder::TrafficRecorder(const std::string & aFileName):
+	mFileName(aFileName)
+{
+	auto path = std::filesystem::u8path(aFileName);
+	auto validSize = validLogSize(path, aFileName);
+
+	// Cut off the record torn by a crash, so that the new records don't follow a partial one. Only an existing file
+	// that has been read and validated is truncated:
+	if (validSize.has_value())
+	{
+		std::error_code ec;
+		auto fileSize = std::filesystem::file_size(path, ec);
+		if (!ec && (fileSize != *validSize))
+		{
+			std::filesystem::resize_file(path, *validSize, ec);
+		}
+		if (ec)
+		{
+			throw Exception(fmt::format("Failed to truncate the incomplete record at the end of traffic log \"{}\": {}", aFileName, ec.message()));
+		}
+	}
+
+	mFile.open(path, std::ios::binary | std::ios::app);
+	if (!mFile.is_open())
+	{
+		throw Exception(fmt::format("Failed to open traffic log \"{}\" for writing.", aFileName));
+	}
+	if (validSize.value_or(0) == 0)
+	{
+		mFile.write(LOG_SIGNATURE, LOG_SIGNATURE_SIZE);
+		mFile.flush();
+	}
+}
+
+
+
+
+
+void TrafficRecorder::record(const TrafficRecord & aRecord)
+{
+	// Serialize everything up to the response body; the body, which may be huge, is written straight from its view:
+	std::string head;
+	head.reserve(
+		64 + aRecord.mHttpVerb.size() + aRecord.mUrl.size() + aRecord.mRange.size() +
+		aRecord.mRequestHeaders.size() + aRecord.mRequestBody.size() + aRecord.mStatusText.size() +
+		aRecord.mResponseHeaders.size()
+	);
+	appendInt<std::uint64_t>(head, 0);  // Placeholder for the payload size
+	appendInt<std::uint32_t>(head, aRecord.mStatusCode);
+	appendInt<std::uint64_t>(head, static_cast<std::uint64_t>(aRecord.mDuration.count()));
+	appendField(head, aRecord.mHttpVerb);
+	appendField(head, aRecord.mUrl);
+	appendField(head, aRecord.mRange);
+	appendField(head, aRecord.mRequestHeaders);
+	appendField(head, aRecord.mRequestBody);
+	appendField(head, aRecord.mStatusText);
+	appendField(head, aRecord.mResponseHeaders);
+	appendInt<std::uint64_t>(head, aRecord.mResponseBody.size());
+	std::string size;
+	appendInt<std::uint64_t>(size, head.size() - sizeof(std::uint64_t) + aRecord.mResponseBody.size());
+	std::memcpy(head.data(), size.data(), size.size());
+
+	std::lock_guard<std::mutex> lock(mMtx);
+	mFile.write(head.data(), static_cast<std::streamsize>(head.size()));
+	mFile.write(aRecord.mResponseBody.data(), static_cast<std::streamsize>(aRecord.mResponseBody.size()));
+	mFile.flush();
+	if (!mFile.good())
+	{
+		throw Exception(fmt::format("Failed to write into traffic log \"{}\".", mFileName));
+	}
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TrafficReplayer:
+
+TrafficReplayer::TrafficReplayer(const std::string & aFileName, bool aShouldReproduceLatency):
+	mFile(INVALID_HANDLE_VALUE),
+	mMapping(nullptr),
+	mData(nullptr),
+	mShouldReproduceLatency(aShouldReproduceLatency)
+{
+	mFile = CreateFileW(std::filesystem::u8path(aFileName).wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		throw Exception(fmt::format("Failed to open traffic log \"{}\", CreateFileW() failed with error code 0x{:x}.", aFileName, GetLastError()));
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || (static_cast<std::uint64_t>(size.QuadPart) < LOG_SIGNATURE_SIZE))
+	{
+		CloseHandle(mFile);
+		throw Exception(fmt::format("The file \"{}\" is not a traffic log.", aFileName));
+	}
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping != nullptr)
+	{
+		mData = static_cast<const char *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (mData == nullptr)
+	{
+		auto err = GetLastError();
+		if (mMapping != nullptr)
+		{
+			CloseHandle(mMapping);
+		}
+		CloseHandle(mFile);
+		throw Exception(fmt::format("Failed to map traffic log \"{}\", error code 0x{:x}.", aFileName, err));
+	}
+	if (std::memcmp(mData, LOG_SIGNATURE, LOG_SIGNATURE_SIZE) != 0)
+	{
+		UnmapViewOfFile(mData);
+		CloseHandle(mMapping);
+		CloseHandle(mFile);
+		throw Exception(fmt::format("The file \"{}\" is not a traffic log.", aFileName));
+	}
+
+	// Index all the complete records:
+	auto end = mData + size.QuadPart;
+	LogReader reader(mData + LOG_SIGNATURE_SIZE, end);
+	while (true)
+	{
+		std::uint64_t payloadSize;
+		if (!reader.readInt(payloadSize) || (static_cast<std::uint64_t>(end - reader.pos()) < payloadSize))
+		{
+			break;
+		}
+		auto next = reader.pos() + payloadSize;
+		LogReader recReader(reader.pos(), next);
+		TrafficRecord rec;
+		std::uint64_t durationUs;
+		if (
+			!recReader.readInt(rec.mStatusCode) ||
+			!recReader.readInt(durationUs) ||
+			!recReader.readField(rec.mHttpVerb) ||
+			!recReader.readField(rec.mUrl) ||
+			!recReader.readField(rec.mRange) ||
+			!recReader.readField(rec.mRequestHeaders) ||
+			!recReader.readField(rec.mRequestBody) ||
+			!recReader.readField(rec.mStatusText) ||
+			!recReader.readField(rec.mResponseHeaders) ||
+			!recReader.readField(rec.mResponseBody)
+		)
+		{
+			break;
+		}
+		rec.mDuration = std::chrono::microseconds(durationUs);
+		mRecords[makeKey(rec.mHttpVerb, rec.mUrl, rec.mRange, rec.mRequestBody)].mRecords.push_back(rec);
+		reader = LogReader(next, end);
+	}
+}
+
+
+
+
+
+TrafficReplayer::~TrafficReplayer()
+{
+	UnmapViewOfFile(mData);
+	CloseHandle(mMapping);
+	CloseHandle(mFile);
+}
+
+
+
+
+
+std::string TrafficReplayer::makeKey(std::string_view aHttpVerb, std::string_view aUrl, std::string_view aRange, std::string_view aRequestBody)
+{
+	std::string res;
+	res.reserve(aHttpVerb.size() + aUrl.size() + aRange.size() + aRequestBody.size() + 3);
+	res.append(aHttpVerb).append(1, '\n');
+	res.append(aUrl).append(1, '\n');
+	res.append(aRange).append(1, '\n');
+	res.append(aRequestBody);
+	return res;
+}
+
+
+
+
+
+TrafficRecord TrafficReplayer::replay(std::string_view aHttpVerb, std::string_view aUrl, std::string_view aRange, std::string_view aRequestBody)
+{
+	TrafficRecord res;
+	{
+		std::lock_guard<std::mutex> lock(mMtx);
+		auto itr = mRecords.find(makeKey(aHttpVerb, aUrl, aRange, aRequestBody));
+		if (itr == mRecords.end())
+		{
+			throw Exception(fmt::format("There is no recorded response for {} {}.", aHttpVerb, aUrl));
+		}
+		auto & keyRecords = itr->second;
+		res = keyRecords.mRecords[keyRecords.mNext];
+		keyRecords.mNext = (keyRecords.mNext + 1) % keyRecords.mRecords.size();
+	}
+	if (mShouldReproduceLatency)
+	{
+		std::this_thread::sleep_for(res.mDuration);
+	}
+	return res;
+}
+
+
+
+
+
+}  // namespace LuaSimpleWinHttp
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+
+
+
+
+
+namespace LuaSimpleWinHttp
+{
+
+
+
+
+
+/*
+The traffic log file format:
+The file starts with the 8-byte signature "LSWHLOG1", followed by any number of records. Each record is:
+	- uint64 payloadSize: the size of the rest of the record
+	- uint32 statusCode
+	- uint64 durationUs: the time it took to make the request, in microseconds
+	- 8 length-prefixed (uint64 length + bytes) fields: verb, url, range, requestHeaders, requestBody,
+	  statusText, responseHeaders, responseBody
+All integers are little-endian. The header fields are joined with CRLF. New records are only ever appended,
+a truncated record at the end of the file (e.g. after a crash) is ignored when replaying, and cut off when the file
+is opened for recording again.
+*/
+
+
+
+
+
+/** One recorded exchange, as stored in the traffic log.
+When read by TrafficReplayer, all the views point into the memory-mapped log file. */
+struct TrafficRecord
+{
+	std::string_view mHttpVerb;
+	std::string_view mUrl;
+
+	/** The value of the request's Range header, if any; part of the key by which the records are matched. */
+	std::string_view mRange;
+
+	/** All the request headers, joined with CRLF. */
+	std::string_view mRequestHeaders;
+
+	std::string_view mRequestBody;
+	std::uint32_t mStatusCode = 0;
+	std::string_view mStatusText;
+
+	/** All the response headers, joined with CRLF. */
+	std::string_view mResponseHeaders;
+
+	std::string_view mResponseBody;
+
+	/** The time it took to make the original request. */
+	std::chrono::microseconds mDuration{0};
+};
+
+
+
+
+
+/** Appends the exchanges made through a Client into a traffic log file.
+Thread-safe, each record is written in one piece. */
+class TrafficRecorder
+{
+	/** Protects mFile against concurrent writes. */
+	std::mutex mMtx;
+
+	/** The log file, opened for appending. */
+	std::ofstream mFile;
+
+	/** The name of the log file, for error messages. */
+	std::string mFileName;
+
+
+public:
+
+	/** Opens the specified log file (UTF-8 path) for appending, creating it if it doesn't exist.
+	An incomplete record at the end of an existing log is truncated first.
+	Throws an Exception on error, or if an existing non-empty file is not a traffic log. */
+	TrafficRecorder(const std::string & aFileName);
+
+	/** Appends the specified exchange to the log.
+	Throws an Exception on error. */
+	void record(const TrafficRecord & aRecord);
+};
+
+
+
+
+
+/** Serves the responses recorded in a traffic log, without any network I/O.
+The log is memory-mapped; the records are matched by the verb, URL, Range header and request body. If there are
+multiple records with the same key, they are served in their recorded order, starting over after the last one. */
+class TrafficReplayer
+{
+	/** The log file handle. */
+	HANDLE mFile;
+
+	/** The file mapping handle. */
+	HANDLE mMapping;
+
+	/** The mapped view of the entire log file. */
+	const char * mData;
+
+	/** The records of the same key, and the index of the one to serve next. */
+	struct KeyRecords
+	{
+		std::vector<TrafficRecord> mRecords;
+		size_t mNext = 0;
+	};
+
+	/** Protects the mNext indices in mRecords. */
+	std::mutex mMtx;
+
+	/** All the records, by their key. */
+	std::unordered_map<std::string, KeyRecords> mRecords;
+
+	/** If true, the recorded durations are reproduced when serving the responses. */
+	bool mShouldReproduceLatency;
+
+
+	/** Returns the key by which the records are matched. */
+	static std::string makeKey(std::string_view aHttpVerb, std::string_view aUrl, std::string_view aRange, std::string_view aRequestBody);
+
+
+public:
+
+	/** Maps the specified log file (UTF-8 path) and indexes all its records.
+	Throws an Exception on error. */
+	TrafficReplayer(const std::string & aFileName, bool aShouldReproduceLatency);
+
+	~TrafficReplayer();
+
+	TrafficReplayer(const TrafficReplayer &) = delete;
+	TrafficReplayer & operator = (const TrafficReplayer &) = delete;
+
+	/** Returns the next recorded exchange matching the request.
+	If latency reproduction is enabled, sleeps for the recorded duration first.
+	The returned record's views stay valid for the lifetime of the replayer.
+	Throws an Exception if there's no matching record. */
+	TrafficRecord replay(std::string_view aHttpVerb, std::string_view aUrl, std::string_view aRange, std::string_view aRequestBody);
+};
+
+}
@@ -0,0 +1,340 @@
+// Compares decoding JSON responses in C++ (lswh.get_json) with the baseline of receiving the body as a Lua string
+// (lswh.get) and parsing it with a pure-Lua JSON decoder, for 10 KiB, 1 MiB and 50 MiB documents.
+// The responses are served from a traffic log that the benchmark writes first, so no network is needed.
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <fmt/format.h>
+
+extern "C"
+{
+	#include <lauxlib.h>
+	#include <lualib.h>
+}
+
+#include "LuaSimpleWinHttp.h"
+#include "TrafficLog.h"
+
+
+
+
+
+/** The traffic log written and replayed by the benchmark, in the current folder. */
+static const char LOG_FILE_NAME[] = "JsonBenchmark.lswhlog";
+
+/** A single benchmarked document. */
+struct Document
+{
+	/** The (approximate) size of the document. */
+	size_t mSize;
+
+	/** The name of the size, for the URL and the output. */
+	const char * mName;
+
+	/** The number of times the document is decoded by each method; the average time is reported. */
+	int mNumRepetitions;
+};
+
+static const Document DOCUMENTS[] =
+{
+	{10 * 1024,         "10KiB", 200},
+	{1024 * 1024,       "1MiB",  5},
+	{50 * 1024 * 1024,  "50MiB", 1},
+};
+
+
+
+
+
+/** The Lua side of the benchmark: the baseline decoder and the two timed methods.
+The decoder is a straightforward recursive-descent parser, in the style of the common pure-Lua JSON libraries. */
+static const char LUA_SCRIPT[] = R"lua(
+local lswh = ...
+local null = lswh.null
+local escapes = {['"'] = '"', ['\\'] = '\\', ['/'] = '/', b = '\b', f = '\f', n = '\n', r = '\r', t = '\t'}
+
+local function utf8char(cp)
+	if cp < 0x80 then
+		return string.char(cp)
+	elseif cp < 0x800 then
+		return string.char(0xc0 + math.floor(cp / 0x40), 0x80 + cp % 0x40)
+	end
+	return string.char(0xe0 + math.floor(cp / 0x1000), 0x80 + math.floor(cp / 0x40) % 0x40, 0x80 + cp % 0x40)
+end
+
+local function decode(str)
+	local pos = 1
+	local parseValue
+
+	local function skipSpace()
+		pos = str:find("[^ \t\r\n]", pos) or (#str + 1)
+	end
+
+	local function parseString()
+		local parts = {}
+		local i = pos + 1
+		while true do
+			local j = str:find('["\\]', i)
+			if not j then
+				error("unterminated string at " .. pos)
+			end
+			parts[#parts + 1] = str:sub(i, j - 1)
+			if str:byte(j) == 34 then  -- "
+				pos = j + 1
+				return table.concat(parts)
+			end
+			local esc = str:sub(j + 1, j + 1)
+			if esc == "u" then
+				parts[#parts + 1] = utf8char(tonumber(str:sub(j + 2, j + 5), 16))
+				i = j + 6
+			else
+				parts[#parts + 1] = escapes[esc] or error("bad escape at " .. j)
+				i = j + 2
+			end
+		end
+	end
+
+	local function parseArray()
+		local res, n = {}, 0
+		pos = pos + 1
+		skipSpace()
+		if str:byte(pos) == 93 then  -- ]
+			pos = pos + 1
+			return res
+		end
+		while true do
+			n = n + 1
+			res[n] = parseValue()
+			skipSpace()
+			local ch = str:byte(pos)
+			pos = pos + 1
+			if ch == 93 then
+				return res
+			elseif ch ~= 44 then  -- ,
+				error("expected ',' or ']' at " .. (pos - 1))
+			end
+		end
+	end
+
+	local function parseObject()
+		local res = {}
+		pos = pos + 1
+		skipSpace()
+		if str:byte(pos) == 125 then  -- }
+			pos = pos + 1
+			return res
+		end
+		while true do
+			skipSpace()
+			if str:byte(pos) ~= 34 then
+				error("expected a key at " .. pos)
+			end
+			local key = parseString()
+			skipSpace()
+			if str:byte(pos) ~= 58 then  -- :
+				error("expected ':' at " .. pos)
+			end
+			pos = pos + 1
+			res[key] = parseValue()
+			skipSpace()
+			local ch = str:byte(pos)
+			pos = pos + 1
+			if ch == 125 then
+				return res
+			elseif ch ~= 44 then
+				error("expected ',' or '}' at " .. (pos - 1))
+			end
+		end
+	end
+
+	parseValue = function()
+		skipSpace()
+		local ch = str:byte(pos)
+		if ch == 123 then
+			return parseObject()
+		elseif ch == 91 then
+			return parseArray()
+		elseif ch == 34 then
+			return parseString()
+		elseif str:find("^true", pos) then
+			pos = pos + 4
+			return true
+		elseif str:find("^false", pos) then
+			pos = pos + 5
+			return false
+		elseif str:find("^null", pos) then
+			pos = pos + 4
+			return null
+		end
+		local num = str:match("^-?%d+%.?%d*[eE]?[-+]?%d*", pos)
+		if not num then
+			error("unexpected character at " .. pos)
+		end
+		pos = pos + #num
+		return tonumber(num)
+	end
+
+	local res = parseValue()
+	skipSpace()
+	if pos <= #str then
+		error("trailing characters at " .. pos)
+	end
+	return res
+end
+
+local methods = {}
+
+function methods.cpp(url)
+	return assert(lswh.get_json(url))
+end
+
+function methods.lua(url)
+	return decode(assert(lswh.get(url)))
+end
+
+-- Runs the method the specified number of times, from a clean heap:
+return function(method, url, numRepetitions)
+	collectgarbage("collect")
+	local res
+	for _ = 1, numRepetitions do
+		res = methods[method](url)
+	end
+	return #res
+end
+)lua";
+
+
+
+
+
+/** Returns a JSON array of objects (typical API response items) that is at least aSize bytes long. */
+static std::string generateDocument(size_t aSize)
+{
+	std::string res("[");
+	for (int i = 0; res.size() < aSize; ++i)
+	{
+		if (i > 0)
+		{
+			res.append(",\n");
+		}
+		res.append(fmt::format(
+			"{{\"id\": {}, \"name\": \"Item #{}\", \"price\": {}.{:02}, \"active\": {}, \"note\": null, "
+			"\"tags\": [\"alpha\", \"beta\", \"gamma\"], \"owner\": {{\"id\": {}, \"login\": \"user{}\", \"path\": \"\\/users\\/{}\"}}}}",
+			i, i, i % 1000, i % 100, ((i % 2) == 0) ? "true" : "false", i % 97, i % 97, i % 97
+		));
+	}
+	res.append("]");
+	return res;
+}
+
+
+
+
+
+/** Returns the URL under which the document is recorded. */
+static std::string documentUrl(const Document & aDocument)
+{
+	return fmt::format("https://bench.example/json/{}", aDocument.mName);
+}
+
+
+
+
+
+/** Records a response for each benchmarked document into a fresh traffic log. */
+static void writeLog()
+{
+	std::filesystem::remove(LOG_FILE_NAME);
+	LuaSimpleWinHttp::TrafficRecorder recorder(LOG_FILE_NAME);
+	for (const auto & doc: DOCUMENTS)
+	{
+		auto url = documentUrl(doc);
+		auto body = generateDocument(doc.mSize);
+		LuaSimpleWinHttp::TrafficRecord rec;
+		rec.mHttpVerb = "GET";
+		rec.mUrl = url;
+		rec.mStatusCode = 200;
+		rec.mStatusText = "OK";
+		rec.mResponseHeaders = "Content-Type: application/json";
+		rec.mResponseBody = body;
+		recorder.record(rec);
+	}
+}
+
+
+
+
+
+/** Calls the benchmark function (on the top of the Lua stack, left there) for the method and document.
+Returns the average time of a single decoding, in milliseconds, and the number of items in the decoded array. */
+static std::pair<double, lua_Integer> run(lua_State * aState, const char * aMethod, const Document & aDocument)
+{
+	lua_pushvalue(aState, -1);
+	lua_pushstring(aState, aMethod);
+	lua_pushstring(aState, documentUrl(aDocument).c_str());
+	lua_pushinteger(aState, aDocument.mNumRepetitions);
+	auto startTime = std::chrono::steady_clock::now();
+	if (lua_pcall(aState, 3, 1, 0) != 0)
+	{
+		throw std::runtime_error(fmt::format("The {} method failed: {}", aMethod, lua_tostring(aState, -1)));
+	}
+	auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime);
+	auto numItems = lua_tointeger(aState, -1);
+	lua_pop(aState, 1);
+	return {duration.count() / aDocument.mNumRepetitions, numItems};
+}
+
+
+
+
+
+int main()
+{
+	try
+	{
+		writeLog();
+
+		auto state = luaL_newstate();
+		luaL_openlibs(state);
+		luaopen_LuaSimpleWinHttp(state);  // Leaves the library table on the stack
+		lua_getfield(state, -1, "replay");
+		lua_pushstring(state, LOG_FILE_NAME);
+		lua_call(state, 1, 2);
+		if (lua_isnil(state, -2))
+		{
+			throw std::runtime_error(fmt::format("Failed to replay the traffic log: {}", lua_tostring(state, -1)));
+		}
+		lua_pop(state, 2);
+		if (luaL_loadbuffer(state, LUA_SCRIPT, sizeof(LUA_SCRIPT) - 1, "JsonBenchmark") != 0)
+		{
+			throw std::runtime_error(fmt::format("Failed to load the benchmark script: {}", lua_tostring(state, -1)));
+		}
+		lua_pushvalue(state, -2);  // The library table, as the script's argument
+		lua_call(state, 1, 1);
+
+		fmt::print("{:>8} {:>14} {:>14} {:>8}\n", "Size", "get_json [ms]", "get+Lua [ms]", "Speedup");
+		for (const auto & doc: DOCUMENTS)
+		{
+			auto [cppTime, cppItems] = run(state, "cpp", doc);
+			auto [luaTime, luaItems] = run(state, "lua", doc);
+			if (cppItems != luaItems)
+			{
+				throw std::runtime_error(fmt::format("The decoders disagree on {}: {} vs {} items", doc.mName, cppItems, luaItems));
+			}
+			fmt::print("{:>8} {:>14.2f} {:>14.2f} {:>7.1f}x\n", doc.mName, cppTime, luaTime, luaTime / cppTime);
+		}
+		lua_close(state);
+		std::filesystem::remove(LOG_FILE_NAME);
+		return 0;
+	}
+	catch (const std::exception & exc)
+	{
+		fmt::print(stderr, "{}\n", exc.what());
+		return 1;
+	}
+}
@@ -0,0 +1,202 @@
+// Compares making a request directly through the C++ API (Request::make()) with making the same request from Lua
+// (lswh.get), in order to quantify the cost of the Lua bindings: reading the parameters off the Lua stack and
+// pushing the body, status and headers back.
+// The responses are served from a traffic log that the benchmark writes first, so no network is needed and the
+// measured time is the request engine plus the marshalling, without any I/O.
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fmt/format.h>
+
+extern "C"
+{
+	#include <lauxlib.h>
+	#include <lualib.h>
+}
+
+#include "LuaSimpleWinHttp.h"
+#include "Request.h"
+#include "TrafficLog.h"
+
+
+
+
+
+/** The traffic log written and replayed by the benchmark, in the current folder. */
+static const char LOG_FILE_NAME[] = "MarshallingBenchmark.lswhlog";
+
+/** The header sent with each request, by both methods. */
+static const char REQUEST_HEADER[] = "Accept: application/json";
+
+/** A single benchmarked response. */
+struct Exchange
+{
+	/** The size of the response body. */
+	size_t mBodySize;
+
+	/** The name of the size, for the URL and the output. */
+	const char * mName;
+
+	/** The number of requests made by each method; the average time is reported. */
+	int mNumRepetitions;
+};
+
+static const Exchange EXCHANGES[] =
+{
+	{0,          "empty", 20000},
+	{1024,       "1KiB",  20000},
+	{64 * 1024,  "64KiB", 2000},
+	{1024 * 1024, "1MiB", 200},
+};
+
+
+
+
+
+/** The Lua side of the benchmark, returns the function that makes the requests. */
+static const char LUA_SCRIPT[] = R"lua(
+local lswh, header = ...
+return function(url, numRepetitions)
+	local params = {headers = {header}}
+	for _ = 1, numRepetitions do
+		assert(lswh.get(url, params))
+	end
+end
+)lua";
+
+
+
+
+
+/** Returns the URL under which the exchange is recorded. */
+static std::string exchangeUrl(const Exchange & aExchange)
+{
+	return fmt::format("https://bench.example/marshalling/{}", aExchange.mName);
+}
+
+
+
+
+
+/** Records each benchmarked exchange into a fresh traffic log, with a typical set of response headers. */
+static void writeLog()
+{
+	std::filesystem::remove(LOG_FILE_NAME);
+	LuaSimpleWinHttp::TrafficRecorder recorder(LOG_FILE_NAME);
+	for (const auto & exchange: EXCHANGES)
+	{
+		auto url = exchangeUrl(exchange);
+		auto body = std::string(exchange.mBodySize, 'x');
+		auto responseHeaders = fmt::format(
+			"Content-Type: application/json; charset=utf-8\r\n"
+			"Content-Length: {}\r\n"
+			"Date: Sun, 18 Oct 2026 10:00:00 GMT\r\n"
+			"Cache-Control: private, max-age=0, no-cache\r\n"
+			"ETag: W/\"0123456789abcdef\"\r\n"
+			"Server: nginx",
+			body.size()
+		);
+		LuaSimpleWinHttp::TrafficRecord rec;
+		rec.mHttpVerb = "GET";
+		rec.mUrl = url;
+		rec.mRequestHeaders = REQUEST_HEADER;
+		rec.mStatusCode = 200;
+		rec.mStatusText = "OK";
+		rec.mResponseHeaders = responseHeaders;
+		rec.mResponseBody = body;
+		recorder.record(rec);
+	}
+}
+
+
+
+
+
+/** Makes the requests for the exchange through the C++ API.
+Returns the average time of a single request, in microseconds. */
+static double runCpp(const Exchange & aExchange)
+{
+	auto url = exchangeUrl(aExchange);
+	auto startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < aExchange.mNumRepetitions; ++i)
+	{
+		LuaSimpleWinHttp::Request req(LuaSimpleWinHttp::Client::defaultClient(), "GET");
+		req.setUrl(std::string(url));
+		req.addHeader(REQUEST_HEADER);
+		auto resp = req.make();
+		if (resp.mBody.size() != aExchange.mBodySize)
+		{
+			throw std::runtime_error(fmt::format("Unexpected body size for {}: {}", aExchange.mName, resp.mBody.size()));
+		}
+	}
+	auto duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime);
+	return duration.count() / aExchange.mNumRepetitions;
+}
+
+
+
+
+
+/** Makes the requests for the exchange through the Lua bindings, using the benchmark function on the top of
+the Lua stack (left there). Returns the average time of a single request, in microseconds. */
+static double runLua(lua_State * aState, const Exchange & aExchange)
+{
+	lua_pushvalue(aState, -1);
+	lua_pushstring(aState, exchangeUrl(aExchange).c_str());
+	lua_pushinteger(aState, aExchange.mNumRepetitions);
+	auto startTime = std::chrono::steady_clock::now();
+	if (lua_pcall(aState, 2, 0, 0) != 0)
+	{
+		throw std::runtime_error(fmt::format("The Lua requests failed: {}", lua_tostring(aState, -1)));
+	}
+	auto duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime);
+	return duration.count() / aExchange.mNumRepetitions;
+}
+
+
+
+
+
+int main()
+{
+	try
+	{
+		writeLog();
+		auto & client = LuaSimpleWinHttp::Client::defaultClient();
+		client.setReplayer(std::make_shared<LuaSimpleWinHttp::TrafficReplayer>(LOG_FILE_NAME, false));
+
+		auto state = luaL_newstate();
+		luaL_openlibs(state);
+		luaopen_LuaSimpleWinHttp(state);  // Leaves the library table on the stack
+		if (luaL_loadbuffer(state, LUA_SCRIPT, sizeof(LUA_SCRIPT) - 1, "MarshallingBenchmark") != 0)
+		{
+			throw std::runtime_error(fmt::format("Failed to load the benchmark script: {}", lua_tostring(state, -1)));
+		}
+		lua_pushvalue(state, -2);  // The library table and the header, as the script's arguments
+		lua_pushstring(state, REQUEST_HEADER);
+		lua_call(state, 2, 1);
+
+		fmt::print("{:>8} {:>12} {:>12} {:>14}\n", "Body", "C++ [us]", "Lua [us]", "Overhead [us]");
+		for (const auto & exchange: EXCHANGES)
+		{
+			auto cppTime = runCpp(exchange);
+			auto luaTime = runLua(state, exchange);
+			fmt::print("{:>8} {:>12.2f} {:>12.2f} {:>14.2f}\n", exchange.mName, cppTime, luaTime, luaTime - cppTime);
+		}
+		lua_close(state);
+		client.setReplayer(nullptr);
+		std::filesystem::remove(LOG_FILE_NAME);
+		return 0;
+	}
+	catch (const std::exception & exc)
+	{
+		fmt::print(stderr, "{}\n", exc.what());
+		return 1;
+	}
+}